@@ -5,10 +5,19 @@ BOOL AclDbCheckCurrentUserAccess(const API_CTX& Ctx,
     int iEntityId, DbAccess eAccess, _Out_ int& r) noexcept;
 
 // WARNING 必须在事务中调用，使用GlobalId的当前值作为entity_id
-int AclDbOnEntityCreate(const API_CTX& Ctx, int iUserId) noexcept;
+// iContainerId为所属的项目或页面组，顶层实体为DbIdInvalid
+// 子实体继承容器的权限，仅当创建者不是容器所有者时插入所有者记录
+int AclDbOnEntityCreate(const API_CTX& Ctx, int iUserId,
+    int iContainerId = DbIdInvalid) noexcept;
 // WARNING 必须在事务中调用
 int AclDbOnEntityDelete(const API_CTX& Ctx, int iEntityId) noexcept;
+// 使AclDbOnEntityCreate/AclDbOnEntityDelete记录的实体的权限缓存失效
+// WARNING 必须在提交事务后调用，回滚后调用仅多失效一次
+void AclDbFlushInvalidation(const API_CTX& Ctx) noexcept;
 
+// 解析当前会话，填充Ctx的iUserId和iPseudoUserId
+void CkDbResolveCurrentUser(API_CTX& Ctx) noexcept;
+// 若Ctx.eRes含Auth则直接返回预先解析的结果
 int CkDbGetCurrentUser(const API_CTX& Ctx) noexcept;
 int CkDbGetCurrentPseudoUser(const API_CTX& Ctx) noexcept;
 
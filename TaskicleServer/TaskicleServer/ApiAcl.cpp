@@ -4,48 +4,239 @@
 #include "Database.h"
 #include "AccessCheck.h"
 
-BOOL AclDbCheckAccess(const API_CTX& Ctx, int iUserId,
-    int iEntityId, DbAccess eAccess, _Out_ int& r) noexcept
+constexpr static size_t AclCacheShardCount = 16;
+constexpr static size_t AclCacheShardCapacity = 1024;
+
+struct ACL_CACHE_KEY
 {
-    if (iUserId == DbIdUserAdmin)
+    int iUserId;
+    int iEntityId;
+
+    bool operator==(const ACL_CACHE_KEY&) const noexcept = default;
+};
+struct ACL_CACHE_KEY_HASH
+{
+    size_t operator()(const ACL_CACHE_KEY& k) const noexcept
     {
-        r = SQLITE_OK;
+        return std::hash<ULONGLONG>{}(
+            ((ULONGLONG)(UINT)k.iUserId << 32) | (UINT)k.iEntityId);
+    }
+};
+struct ACL_CACHE_ENTRY
+{
+    ACL_CACHE_KEY Key;
+    DbAccess eAccess;// 生效的掩码，已应用容器继承
+    BOOL bAdmin;
+    int iContainerId;// 掩码继承自此容器时，其修改须使本项失效
+};
+
+// 权限缓存分片，同一实体的所有表项位于同一分片
+// 查询数据库前取得纪元，若期间发生失效则丢弃查询结果
+// 表项同时按实体和继承来源的容器建立索引，失效时无需遍历整个分片
+class CAclCacheShard
+{
+private:
+    using TLruIt = std::list<ACL_CACHE_ENTRY>::iterator;
+
+    eck::CSrwLock m_Lk{};
+    // 头部为最近使用
+    std::list<ACL_CACHE_ENTRY> m_Lru{};
+    std::unordered_map<ACL_CACHE_KEY, TLruIt, ACL_CACHE_KEY_HASH> m_Map{};
+    // 实体ID -> 该实体的表项
+    std::unordered_multimap<int, TLruIt> m_ByEntity{};
+    // 容器ID -> 继承自该容器的表项
+    std::unordered_multimap<int, TLruIt> m_ByContainer{};
+    // Insert在写锁内比较，失效时先递增再检查索引，使递增前发起的查询无法写入
+    std::atomic<ULONGLONG> m_nEpoch{};
+
+    static void EraseIndex(std::unordered_multimap<int, TLruIt>& Index,
+        int iKey, TLruIt itEntry) noexcept
+    {
+        const auto [itBegin, itEnd] = Index.equal_range(iKey);
+        for (auto it = itBegin; it != itEnd; ++it)
+            if (it->second == itEntry)
+            {
+                Index.erase(it);
+                return;
+            }
+    }
+
+    void EraseLocked(TLruIt it) noexcept
+    {
+        EraseIndex(m_ByEntity, it->Key.iEntityId, it);
+        if (it->iContainerId != DbIdInvalid)
+            EraseIndex(m_ByContainer, it->iContainerId, it);
+        m_Map.erase(it->Key);
+        m_Lru.erase(it);
+    }
+
+    // 收集索引中匹配用户的表项，擦除会使equal_range失效，因此先复制
+    static void CollectLocked(const std::unordered_multimap<int, TLruIt>& Index,
+        int iKey, int iUserId, std::vector<TLruIt>& vEntry) noexcept
+    {
+        const auto [itBegin, itEnd] = Index.equal_range(iKey);
+        for (auto it = itBegin; it != itEnd; ++it)
+            if (iUserId == DbIdInvalid || it->second->Key.iUserId == iUserId)
+                vEntry.emplace_back(it->second);
+    }
+public:
+    // 未命中时返回FALSE，并输出当前纪元
+    BOOL Lookup(const ACL_CACHE_KEY& Key,
+        _Out_ ACL_CACHE_ENTRY& Entry, _Out_ ULONGLONG& nEpoch) noexcept
+    {
+        eck::CSrwWriteGuard _{ m_Lk };
+        const auto it = m_Map.find(Key);
+        if (it == m_Map.end())
+        {
+            nEpoch = m_nEpoch.load(std::memory_order_acquire);
+            return FALSE;
+        }
+        m_Lru.splice(m_Lru.begin(), m_Lru, it->second);
+        Entry = *it->second;
         return TRUE;
     }
 
-    constexpr char Sql[]{ R"sql(
-SELECT 
-    CASE 
-        WHEN (SELECT role FROM User WHERE user_id = :uid) = )sql" TKK_DBUR_ADMIN R"sql( THEN 1
-        ELSE (
-            SELECT COUNT(*)
-            FROM Acl a
-            WHERE a.user_id = :uid
-                AND a.entity_id = :eid
-                AND ((a.access & :e = :e) OR (a.access & )sql" TKK_DBAC_FULLCTRL R"sql( != 0))
-        )
-    END AS has_access;
-)sql" };
+    void Insert(const ACL_CACHE_ENTRY& Entry, ULONGLONG nEpoch) noexcept
+    {
+        eck::CSrwWriteGuard _{ m_Lk };
+        if (nEpoch != m_nEpoch.load(std::memory_order_relaxed) ||
+            m_Map.contains(Entry.Key))
+            return;
+        if (m_Map.size() >= AclCacheShardCapacity)
+            EraseLocked(std::prev(m_Lru.end()));
+        m_Lru.emplace_front(Entry);
+        m_Map.emplace(Entry.Key, m_Lru.begin());
+        m_ByEntity.emplace(Entry.Key.iEntityId, m_Lru.begin());
+        if (Entry.iContainerId != DbIdInvalid)
+            m_ByContainer.emplace(Entry.iContainerId, m_Lru.begin());
+    }
+
+    // 移除实体本身及继承自该实体的表项，iUserId为DbIdInvalid时匹配所有用户
+    void InvalidateEntity(int iEntityId, int iUserId = DbIdInvalid) noexcept
+    {
+        m_nEpoch.fetch_add(1, std::memory_order_acq_rel);
+        // 递增纪元后不会再写入旧结果，分片中没有相关表项时无需取得写锁
+        {
+            eck::CSrwReadGuard _{ m_Lk };
+            if (!m_ByEntity.contains(iEntityId) && !m_ByContainer.contains(iEntityId))
+                return;
+        }
+        eck::CSrwWriteGuard _{ m_Lk };
+        std::vector<TLruIt> vEntry{};
+        CollectLocked(m_ByEntity, iEntityId, iUserId, vEntry);
+        CollectLocked(m_ByContainer, iEntityId, iUserId, vEntry);
+        for (const auto it : vEntry)
+            EraseLocked(it);
+    }
+};
+
+static CAclCacheShard s_AclCache[AclCacheShardCount]{};
+
+static CAclCacheShard& AclpGetCacheShard(int iEntityId) noexcept
+{
+    return s_AclCache[(UINT)iEntityId % AclCacheShardCount];
+}
+
+// 子实体的表项分散于各分片，容器权限变化时须检查全部分片
+static void AclpInvalidateCache(int iEntityId, int iUserId = DbIdInvalid) noexcept
+{
+    for (auto& e : s_AclCache)
+        e.InvalidateEntity(iEntityId, iUserId);
+}
+
+// 事务中创建或删除的实体，保存在连接上，提交后才使缓存失效
+// 若在提交前失效，其他连接仍可能读到提交前的快照并以新纪元写入缓存，且此后不会再失效
+constexpr static char AclPendingName[]{ "Tkk.AclPending" };
+
+static void AclpDeferInvalidation(sqlite3* pSqlite, int iEntityId) noexcept
+{
+    auto pvPending = (std::vector<int>*)sqlite3_get_clientdata(pSqlite, AclPendingName);
+    if (!pvPending)
+    {
+        pvPending = new std::vector<int>{};
+        sqlite3_set_clientdata(pSqlite, AclPendingName, pvPending,
+            [](void* p) { delete (std::vector<int>*)p; });
+    }
+    pvPending->emplace_back(iEntityId);
+}
+
+void AclDbFlushInvalidation(const API_CTX& Ctx) noexcept
+{
+    if (!Ctx.pSqlite)
+        return;
+    const auto pvPending = (std::vector<int>*)sqlite3_get_clientdata(
+        Ctx.pSqlite, AclPendingName);
+    if (!pvPending)
+        return;
+    for (const auto iEntityId : *pvPending)
+        AclpInvalidateCache(iEntityId);
+    pvPending->clear();
+}
 
+// 查询用户的管理员标志和对实体的权限掩码，结果将写入缓存
+// 实体没有该用户的记录时继承其容器的记录
+static int AclDbpQueryAccess(const API_CTX& Ctx,
+    const ACL_CACHE_KEY& Key, ULONGLONG nEpoch,
+    _Out_ ACL_CACHE_ENTRY& Entry) noexcept
+{
+    constexpr auto& Sql = TKK_DB_SQL(R"sql(
+WITH e(container_id) AS (
+    SELECT container_id FROM Entity WHERE entity_id = :eid
+)
+SELECT
+    (SELECT role FROM User WHERE user_id = :uid),
+    (SELECT access FROM Acl WHERE user_id = :uid AND entity_id = :eid),
+    (SELECT container_id FROM e),
+    (SELECT access FROM Acl WHERE user_id = :uid AND entity_id = (SELECT container_id FROM e));
+)sql");
+
+    Entry = { Key, DbAccess::None, FALSE, DbIdInvalid };
     sqlite3_stmt* pStmt;
-    r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-        EckStrAndLen(Sql), 0, &pStmt, nullptr);
+    int r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
     if (r != SQLITE_OK)
-        return FALSE;
-    sqlite3_bind_int(pStmt, sqlite3_bind_parameter_index(pStmt, ":uid"), iUserId);
-    sqlite3_bind_int(pStmt, sqlite3_bind_parameter_index(pStmt, ":eid"), iEntityId);
-    sqlite3_bind_int(pStmt, sqlite3_bind_parameter_index(pStmt, ":e"), (int)eAccess);
+        return r;
+    sqlite3_bind_int(pStmt, sqlite3_bind_parameter_index(pStmt, ":uid"), Key.iUserId);
+    sqlite3_bind_int(pStmt, sqlite3_bind_parameter_index(pStmt, ":eid"), Key.iEntityId);
     r = sqlite3_step(pStmt);
-    BOOL b;
     if (r == SQLITE_ROW)
     {
         r = SQLITE_OK;
-        b = !!sqlite3_column_int(pStmt, 0);
+        // 不缓存不存在的用户，防止其注册后读到旧的管理员标志
+        const auto bUserExists = sqlite3_column_type(pStmt, 0) != SQLITE_NULL;
+        Entry.bAdmin = sqlite3_column_int(pStmt, 0) == (int)DbUserRole::Admin;
+        if (sqlite3_column_type(pStmt, 1) != SQLITE_NULL)
+            Entry.eAccess = (DbAccess)sqlite3_column_int(pStmt, 1);
+        else if (sqlite3_column_type(pStmt, 2) != SQLITE_NULL)
+        {
+            Entry.iContainerId = sqlite3_column_int(pStmt, 2);
+            Entry.eAccess = (DbAccess)sqlite3_column_int(pStmt, 3);
+        }
+        if (bUserExists || Key.iUserId == DbIdUserGuest)
+            AclpGetCacheShard(Key.iEntityId).Insert(Entry, nEpoch);
     }
-    else
-        b = FALSE;
-    sqlite3_finalize(pStmt);
-    return b;
+    DbFinalize(pStmt);
+    return r;
+}
+
+BOOL AclDbCheckAccess(const API_CTX& Ctx, int iUserId,
+    int iEntityId, DbAccess eAccess, _Out_ int& r) noexcept
+{
+    r = SQLITE_OK;
+    if (iUserId == DbIdUserAdmin)
+        return TRUE;
+
+    const ACL_CACHE_KEY Key{ iUserId, iEntityId };
+    ACL_CACHE_ENTRY Entry;
+    ULONGLONG nEpoch;
+    if (!AclpGetCacheShard(iEntityId).Lookup(Key, Entry, nEpoch))
+    {
+        r = AclDbpQueryAccess(Ctx, Key, nEpoch, Entry);
+        if (r != SQLITE_OK)
+            return FALSE;
+    }
+    return Entry.bAdmin ||
+        (Entry.eAccess & eAccess) == eAccess ||
+        (Entry.eAccess & DbAccess::FullControl) != DbAccess::None;
 }
 
 BOOL AclDbCheckCurrentUserAccess(const API_CTX& Ctx, int iEntityId,
@@ -54,42 +245,70 @@ BOOL AclDbCheckCurrentUserAccess(const API_CTX& Ctx, int iEntityId,
     return AclDbCheckAccess(Ctx, CkDbGetCurrentUser(Ctx), iEntityId, eAccess, r);
 }
 
-int AclDbOnEntityCreate(const API_CTX& Ctx, int iUserId) noexcept
+int AclDbOnEntityCreate(const API_CTX& Ctx, int iUserId, int iContainerId) noexcept
 {
-    constexpr char Sql[]{ R"(
-INSERT INTO Acl(user_id, entity_id, access)
-VALUES (?, (SELECT id FROM GlobalId), ?),)"
-"(" TKK_DBID_USER_ADMIN ", (SELECT id FROM GlobalId), " TKK_DBAC_ADMIN ")"
-    };
+    int r{};
+    // 创建者已是容器所有者（或管理员）时子实体直接继承，无需插入记录
+    const auto bInherit = (iContainerId != DbIdInvalid &&
+        AclDbCheckAccess(Ctx, iUserId, iContainerId, DbAccess::Unused, r));
+    if (iContainerId != DbIdInvalid && r != SQLITE_OK)
+        return r;
 
     sqlite3_stmt* pStmt;
-    int r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-        EckStrAndLen(Sql), 0, &pStmt, nullptr);
+    r = DbPrepare(Ctx.pSqlite, TKK_DB_SQL("SELECT id FROM GlobalId;"), pStmt);
     if (r != SQLITE_OK)
         return r;
-    sqlite3_bind_int(pStmt, 1, iUserId);
-    sqlite3_bind_int(pStmt, 2, (int)DbAccess::Owner);
     r = sqlite3_step(pStmt);
-    sqlite3_finalize(pStmt);
-    if (r == SQLITE_DONE)
+    const auto iEntityId = (r == SQLITE_ROW ? sqlite3_column_int(pStmt, 0) : DbIdInvalid);
+    DbFinalize(pStmt);
+    if (r != SQLITE_ROW)
+        return r;
+    r = SQLITE_OK;
+
+    if (!bInherit)
+    {
+        // 子实体的管理员记录由容器继承
+        constexpr auto& SqlChild = TKK_DB_SQL(R"(
+INSERT INTO Acl(user_id, entity_id, access) VALUES (?, ?, ?);
+)");
+        constexpr auto& SqlTopLevel = TKK_DB_SQL(R"(
+INSERT INTO Acl(user_id, entity_id, access)
+VALUES (?, ?, ?),)"
+"(" TKK_DBID_USER_ADMIN ", ?2, " TKK_DBAC_ADMIN ")");
+        if (iContainerId != DbIdInvalid)
+            r = DbPrepare(Ctx.pSqlite, SqlChild, pStmt);
+        else
+            r = DbPrepare(Ctx.pSqlite, SqlTopLevel, pStmt);
+        if (r != SQLITE_OK)
+            return r;
+        sqlite3_bind_int(pStmt, 1, iUserId);
+        sqlite3_bind_int(pStmt, 2, iEntityId);
+        sqlite3_bind_int(pStmt, 3, (int)DbAccess::Owner);
+        r = sqlite3_step(pStmt);
+        DbFinalize(pStmt);
+        if (r != SQLITE_DONE)
+            return r;
         r = SQLITE_OK;
+    }
+    // 新ID此前可能已被查询过
+    AclpDeferInvalidation(Ctx.pSqlite, iEntityId);
     return r;
 }
 int AclDbOnEntityDelete(const API_CTX& Ctx, int iEntityId) noexcept
 {
-    constexpr char Sql[]{ R"(
+    constexpr auto& Sql = TKK_DB_SQL(R"(
 DELETE FROM Acl WHERE entity_id = ?;
-)" };
+)");
     sqlite3_stmt* pStmt;
-    int r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-        EckStrAndLen(Sql), 0, &pStmt, nullptr);
+    int r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
     if (r != SQLITE_OK)
         return r;
     sqlite3_bind_int(pStmt, 1, iEntityId);
     r = sqlite3_step(pStmt);
     if (r == SQLITE_DONE)
         r = SQLITE_OK;
-    sqlite3_finalize(pStmt);
+    DbFinalize(pStmt);
+    AclpDeferInvalidation(Ctx.pSqlite, iEntityId);
     return r;
 }
 
@@ -142,39 +361,49 @@ static void AwModifyAccess(const API_CTX& Ctx) noexcept
             goto Exit;
         }
 
+        // 实体没有该用户的记录时，以继承自容器的掩码为基础插入记录
         sqlite3_stmt* pStmt;
         if (bRemove)
         {
-            constexpr char Sql[]{ R"(
-UPDATE Acl SET access = (access & ~?)
-WHERE user_id = ? AND entity_id = ?;
-)" };
-            r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-                EckStrAndLen(Sql), 0, &pStmt, nullptr);
+            constexpr auto& Sql = TKK_DB_SQL(R"(
+INSERT INTO Acl(user_id, entity_id, access)
+VALUES (?2, ?3, IFNULL((
+    SELECT access FROM Acl
+    WHERE user_id = ?2 AND entity_id = (
+        SELECT container_id FROM Entity WHERE entity_id = ?3)
+), 0) & ~?1)
+ON CONFLICT(user_id, entity_id) DO UPDATE SET access = (access & ~?1);
+)");
+            r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         }
         else
         {
-            constexpr char Sql[]{ R"(
-UPDATE Acl SET access = (access | ?)
-WHERE user_id = ? AND entity_id = ?;
-)" };
-            r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-                EckStrAndLen(Sql), 0, &pStmt, nullptr);
+            constexpr auto& Sql = TKK_DB_SQL(R"(
+INSERT INTO Acl(user_id, entity_id, access)
+VALUES (?2, ?3, IFNULL((
+    SELECT access FROM Acl
+    WHERE user_id = ?2 AND entity_id = (
+        SELECT container_id FROM Entity WHERE entity_id = ?3)
+), 0) | ?1)
+ON CONFLICT(user_id, entity_id) DO UPDATE SET access = (access | ?1);
+)");
+            r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         }
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
         sqlite3_bind_int(pStmt, 1, (int)eAccess);
         sqlite3_bind_int(pStmt, 2, iUserId);
         sqlite3_bind_int(pStmt, 3, iEntityId);
         r = sqlite3_step(pStmt);
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
+        AclpInvalidateCache(iEntityId, iUserId);
         if (r == SQLITE_DONE)
             r = SQLITE_OK;
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::BadPayload;
@@ -232,29 +461,36 @@ static void AwModifyAccessUser(const API_CTX& Ctx) noexcept
         sqlite3_stmt* pStmt;
         if (bRemove)
         {
-            constexpr char Sql[]{ "DELETE FROM Acl WHERE user_id = ? AND entity = ?" };
-            r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-                EckStrAndLen(Sql), 0, &pStmt, nullptr);
+            constexpr auto& Sql = TKK_DB_SQL("DELETE FROM Acl WHERE user_id = ? AND entity_id = ?");
+            r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         }
         else
         {
-            constexpr char Sql[]{ "INSERT INTO Acl (user_id, entity_id) VALUES (?, ?)" };
-            r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-                EckStrAndLen(Sql), 0, &pStmt, nullptr);
+            // 以继承自容器的掩码初始化，加入ACL不改变生效的权限
+            constexpr auto& Sql = TKK_DB_SQL(R"(
+INSERT INTO Acl (user_id, entity_id, access)
+VALUES (?1, ?2, IFNULL((
+    SELECT access FROM Acl
+    WHERE user_id = ?1 AND entity_id = (
+        SELECT container_id FROM Entity WHERE entity_id = ?2)
+), 0));
+)");
+            r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         }
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
         sqlite3_bind_int(pStmt, 1, iUserId);
         sqlite3_bind_int(pStmt, 2, iEntityId);
         r = sqlite3_step(pStmt);
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
+        AclpInvalidateCache(iEntityId, iUserId);
         if (r == SQLITE_DONE)
             r = SQLITE_OK;
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::BadPayload;
@@ -276,10 +512,8 @@ static void AwGetAcl(const API_CTX& Ctx) noexcept
     int r{};
     PCSTR pszErrMsg{};
 
-    std::vector<QUERY_KV> vKv{};
-    ApiParseQueryString(Ctx, vKv);
     int iUserId{ DbIdInvalid }, iEntityId{ DbIdInvalid };
-    for (const auto& e : vKv)
+    for (const auto& e : ApiGetQuery(Ctx))
     {
         if (TKK_API_HIT_QUERY("user_id"))
             ApiParseInt(e.V, iUserId);
@@ -292,13 +526,12 @@ static void AwGetAcl(const API_CTX& Ctx) noexcept
 
     if (iUserId != DbIdInvalid)
     {
-        constexpr char Sql[]{ R"(SELECT entity_id, access FROM Acl WHERE user_id = ?;)" };
+        constexpr auto& Sql = TKK_DB_SQL(R"(SELECT entity_id, access FROM Acl WHERE user_id = ?;)");
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-            EckStrAndLen(Sql), 0, &pStmt, nullptr);
+        r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
         sqlite3_bind_int(pStmt, 1, iUserId);
@@ -311,21 +544,20 @@ static void AwGetAcl(const API_CTX& Ctx) noexcept
             };
             Arr.ArrPushBack(Obj);
         }
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
         if (r == SQLITE_DONE)
             r = SQLITE_OK;
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else if (iEntityId != DbIdInvalid)
     {
-        constexpr char Sql[]{ R"(SELECT user_id, access FROM Acl WHERE entity_id = ?;)" };
+        constexpr auto& Sql = TKK_DB_SQL(R"(SELECT user_id, access FROM Acl WHERE entity_id = ?;)");
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-            EckStrAndLen(Sql), 0, &pStmt, nullptr);
+        r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
         sqlite3_bind_int(pStmt, 1, iEntityId);
@@ -338,11 +570,11 @@ static void AwGetAcl(const API_CTX& Ctx) noexcept
             };
             Arr.ArrPushBack(Obj);
         }
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
         if (r == SQLITE_DONE)
             r = SQLITE_OK;
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::RequiredFieldMissing;
@@ -36,38 +36,40 @@ static void AwInsertPage(const API_CTX& Ctx) noexcept
             goto Exit;
         }
 
-        constexpr char Sql[]{ R"(
+        constexpr auto& Sql = TKK_DB_SQL(R"(
 INSERT INTO Page(page_id, page_group_id, page_name)
 VALUES ((SELECT id FROM GlobalId), ?, ?);
-)" };
+)");
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-            EckStrAndLen(Sql), 0, &pStmt, nullptr);
+        r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
         sqlite3_bind_int(pStmt, 1, ValGroup.GetInt());
         SuBindJsonStringValue(pStmt, 2, ValName, "Untitled Page"sv);
 
-        CSqliteTransaction Tx{ Ctx.pExtra->pSqlite };
-        r = DbIncrementId(Ctx.pExtra->pSqlite);
+        CSqliteTransaction Tx{ Ctx.pSqlite };
+        r = DbIncrementId(Ctx.pSqlite);
         if (r == SQLITE_OK)
         {
             r = sqlite3_step(pStmt);
             if (r == SQLITE_DONE)
             {
-                iNewPageId = (int)sqlite3_last_insert_rowid(Ctx.pExtra->pSqlite);
-                r = AclDbOnEntityCreate(Ctx, iUserId);
+                iNewPageId = (int)sqlite3_last_insert_rowid(Ctx.pSqlite);
+                r = AclDbOnEntityCreate(Ctx, iUserId, ValGroup.GetInt());
             }
         }
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
         if (r == SQLITE_OK)
+        {
             Tx.Commit();
+            AclDbFlushInvalidation(Ctx);
+        }
         else
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             iNewPageId = DbIdInvalid;
         }
     }
@@ -116,25 +118,24 @@ static void AwUpdatePage(const API_CTX& Ctx) noexcept
             goto Exit;
         }
 
-        constexpr char Sql[]{ R"(UPDATE Page SET page_name = ? WHERE page_id = ?;)" };
+        constexpr auto& Sql = TKK_DB_SQL(R"(UPDATE Page SET page_name = ? WHERE page_id = ?;)");
 
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-            EckStrAndLen(Sql), 0, &pStmt, nullptr);
+        r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
         SuBindJsonStringValue(pStmt, 1, ValName);
         sqlite3_bind_int(pStmt, 2, ValId.GetInt());
 
         r = sqlite3_step(pStmt);
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
         if (r == SQLITE_DONE)
             r = SQLITE_OK;
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::BadPayload;
@@ -177,26 +178,28 @@ static void AwDeletePage(const API_CTX& Ctx) noexcept
             goto Exit;
         }
 
-        constexpr char Sql[]{ R"(DELETE FROM Page WHERE page_id = ?)" };
+        constexpr auto& Sql = TKK_DB_SQL(R"(DELETE FROM Page WHERE page_id = ?)");
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-            EckStrAndLen(Sql), 0, &pStmt, nullptr);
+        r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
         sqlite3_bind_int(pStmt, 1, ValId.GetInt());
 
-        CSqliteTransaction Tx{ Ctx.pExtra->pSqlite };
+        CSqliteTransaction Tx{ Ctx.pSqlite };
         r = sqlite3_step(pStmt);
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
         if (r == SQLITE_DONE)
             r = AclDbOnEntityDelete(Ctx, ValId.GetInt());
         if (r == SQLITE_OK)
+        {
             Tx.Commit();
+            AclDbFlushInvalidation(Ctx);
+        }
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::BadPayload;
@@ -218,15 +221,16 @@ static void AwGetPageList(const API_CTX& Ctx) noexcept
     int r{};
     PCSTR pszErrMsg{};
 
-    std::vector<QUERY_KV> vKv{};
-    ApiParseQueryString(Ctx, vKv);
     int cEntry{}, nPage{}, iGroupId{ DbIdInvalid };
-    for (const auto& e : vKv)
+    std::string_view svCursor{};
+    for (const auto& e : ApiGetQuery(Ctx))
     {
         if (TKK_API_HIT_QUERY("count"))
             ApiParseInt(e.V, cEntry);
         else if (TKK_API_HIT_QUERY("page"))
             ApiParseInt(e.V, nPage);
+        else if (TKK_API_HIT_QUERY("cursor"))
+            svCursor = e.V;
         else if (TKK_API_HIT_QUERY("group_id"))
             ApiParseInt(e.V, iGroupId);
     }
@@ -234,62 +238,87 @@ static void AwGetPageList(const API_CTX& Ctx) noexcept
     if (cEntry <= 0 || cEntry > MaxQueryCount)
         cEntry = MaxQueryCount;
 
-    Json::CMutDoc j{};
-    const auto Arr = j.NewArray();
+    auto& rbJson = ApiGetJsonBuffer();
+    CJsonWriter w{ rbJson };
+    w.BeginObject().Key("data").BeginArray();
+
+    // 带游标时从游标处继续，忽略page
+    API_CURSOR Cursor{ LLONG_MIN, 0 };
+    int cRow{};
+    if (!svCursor.empty())
+    {
+        if (!ApiParseCursor(svCursor, Cursor))
+        {
+            rApi = ApiResult::BadPayload;
+            goto Exit;
+        }
+        nPage = 0;
+    }
 
     if (iGroupId != DbIdInvalid)
     {
-        constexpr char Sql[]{ R"(
+        // 没有显式记录的页面继承页面组的权限，只需判断一次
+        const auto iUserId = CkDbGetCurrentPseudoUser(Ctx);
+        const auto bInherit = AclDbCheckAccess(Ctx, iUserId,
+            iGroupId, DbAccess::ReadContent, r);
+        if (r != SQLITE_OK)
+        {
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
+            goto Exit;
+        }
+
+        constexpr auto& Sql = TKK_DB_SQL(R"(
 SELECT p.page_id, p.page_name, p.create_at, p.has_draft
 FROM Page AS p
-JOIN Acl AS a
-ON a.entity_id = p.page_id
+LEFT JOIN Acl AS a
+ON a.user_id = ?2 AND a.entity_id = p.page_id
 WHERE
-    p.page_group_id = ? AND
-    a.user_id = ? AND
-    (a.access & ?) != 0
+    p.page_group_id = ?1 AND
+    CASE WHEN a.access IS NULL THEN ?3 ELSE (a.access & ?4) != 0 END AND
+    p.page_id > ?7
 ORDER BY p.page_id ASC
-LIMIT ? OFFSET ?;
-)" };
+LIMIT ?5 OFFSET ?6;
+)");
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-            EckStrAndLen(Sql), 0, &pStmt, nullptr);
+        r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
         sqlite3_bind_int(pStmt, 1, iGroupId);
-        sqlite3_bind_int(pStmt, 2, CkDbGetCurrentPseudoUser(Ctx));
-        sqlite3_bind_int(pStmt, 3, int(DbAccess::ReadContent | DbAccess::FullControl));
-        sqlite3_bind_int(pStmt, 4, cEntry);
-        sqlite3_bind_int(pStmt, 5, nPage * cEntry);
+        sqlite3_bind_int(pStmt, 2, iUserId);
+        sqlite3_bind_int(pStmt, 3, bInherit);
+        sqlite3_bind_int(pStmt, 4, int(DbAccess::ReadContent | DbAccess::FullControl));
+        sqlite3_bind_int(pStmt, 5, cEntry);
+        sqlite3_bind_int(pStmt, 6, nPage * cEntry);
+        sqlite3_bind_int64(pStmt, 7, Cursor.k1);
         while ((r = sqlite3_step(pStmt)) == SQLITE_ROW)
         {
-            const auto Obj = j.NewObject();
-            Obj = {
-                "page_id", sqlite3_column_int(pStmt, 0),
-                "page_name", SuColumnStringView(pStmt, 1),
-                "create_at", sqlite3_column_int64(pStmt, 2),
-                "has_draft", (bool)!!sqlite3_column_int(pStmt, 3),
-            };
-            Arr.ArrPushBack(Obj);
+            Cursor = { sqlite3_column_int64(pStmt, 0) };
+            ++cRow;
+            w.BeginObject()
+                .Member("page_id", sqlite3_column_int(pStmt, 0))
+                .Member("page_name", SuColumnStringView(pStmt, 1))
+                .Member("create_at", sqlite3_column_int64(pStmt, 2))
+                .Member("has_draft", (bool)!!sqlite3_column_int(pStmt, 3))
+                .EndObject();
         }
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
         if (r == SQLITE_DONE)
             r = SQLITE_OK;
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::RequiredFieldMissing;
 Exit:
-    j = {
-        "r", r == SQLITE_OK ? rApi : ApiResult::Database,
-        "r2", r,
-        "err_msg", pszErrMsg,
-        "data", Arr
-    };
-    ApiSendResponseJson(Ctx, j);
+    w.EndArray();
+    ApiWriteNextCursor(w, cRow == cEntry, Cursor);
+    w.Member("r", r == SQLITE_OK ? rApi : ApiResult::Database)
+        .Member("r2", r)
+        .Member("err_msg", pszErrMsg)
+        .EndObject();
+    ApiSendResponseJson(Ctx, rbJson);
 }
 TKK_API_DEF_ENTRY(ApiGet_PageList, AwGetPageList)
\ No newline at end of file
@@ -22,36 +22,38 @@ static void AwInsertPageGroup(const API_CTX& Ctx) noexcept
 
     if (Json::CDoc jIn{ Ctx.pExtra->rbBody }; jIn.IsValid())
     {
-        constexpr char Sql[]{ R"(
+        constexpr auto& Sql = TKK_DB_SQL(R"(
 INSERT INTO PageGroup(page_group_id, group_name)
 VALUES ((SELECT id FROM GlobalId), ?);
-)" };
+)");
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-            EckStrAndLen(Sql), 0, &pStmt, nullptr);
+        r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
 
         const auto ValName = jIn["/group_name"];
         SuBindJsonStringValueSafe(pStmt, 1, ValName, "Untitled Page Group"sv);
 
-        CSqliteTransaction Tx{ Ctx.pExtra->pSqlite };
-        r = DbIncrementId(Ctx.pExtra->pSqlite);
+        CSqliteTransaction Tx{ Ctx.pSqlite };
+        r = DbIncrementId(Ctx.pSqlite);
         if (r == SQLITE_OK)
         {
             r = sqlite3_step(pStmt);
             if (r == SQLITE_DONE)
                 r = AclDbOnEntityCreate(Ctx, iUserId);
         }
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
 
         if (r == SQLITE_OK)
+        {
             Tx.Commit();
+            AclDbFlushInvalidation(Ctx);
+        }
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::BadPayload;
@@ -94,27 +96,29 @@ static void AwDeletePageGroup(const API_CTX& Ctx) noexcept
             goto Exit;
         }
 
-        constexpr char Sql[]{ R"(DELETE FROM PageGroup WHERE page_group_id = ?)" };
+        constexpr auto& Sql = TKK_DB_SQL(R"(DELETE FROM PageGroup WHERE page_group_id = ?)");
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-            EckStrAndLen(Sql), 0, &pStmt, nullptr);
+        r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
         sqlite3_bind_int(pStmt, 1, ValId.GetInt());
 
-        CSqliteTransaction Tx{ Ctx.pExtra->pSqlite };
+        CSqliteTransaction Tx{ Ctx.pSqlite };
         r = sqlite3_step(pStmt);
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
         if (r == SQLITE_DONE)
             r = AclDbOnEntityDelete(Ctx, ValId.GetInt());
 
         if (r == SQLITE_OK)
+        {
             Tx.Commit();
+            AclDbFlushInvalidation(Ctx);
+        }
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::BadPayload;
@@ -157,23 +161,22 @@ static void AwUpdatePageGroup(const API_CTX& Ctx) noexcept
             rApi = ApiResult::AccessDenied;
             goto Exit;
         }
-        constexpr char Sql[]{ R"(UPDATE PageGroup SET group_name = ? WHERE page_group_id = ?)" };
+        constexpr auto& Sql = TKK_DB_SQL(R"(UPDATE PageGroup SET group_name = ? WHERE page_group_id = ?)");
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-            EckStrAndLen(Sql), 0, &pStmt, nullptr);
+        r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
         SuBindJsonStringValue(pStmt, 1, ValName);
         sqlite3_bind_int(pStmt, 2, ValId.GetInt());
         r = sqlite3_step(pStmt);
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
         if (r == SQLITE_DONE)
             r = SQLITE_OK;
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::BadPayload;
@@ -195,67 +198,84 @@ static void AwGetPageGroupList(const API_CTX& Ctx) noexcept
     int r{};
     PCSTR pszErrMsg{};
 
-    std::vector<QUERY_KV> vKv{};
-    ApiParseQueryString(Ctx, vKv);
     int cEntry{}, nPage{};
-    for (const auto& e : vKv)
+    std::string_view svCursor{};
+    for (const auto& e : ApiGetQuery(Ctx))
     {
         if (TKK_API_HIT_QUERY("count"))
             ApiParseInt(e.V, cEntry);
         else if (TKK_API_HIT_QUERY("page"))
             ApiParseInt(e.V, nPage);
+        else if (TKK_API_HIT_QUERY("cursor"))
+            svCursor = e.V;
     }
     if (cEntry <= 0 || cEntry > MaxQueryCount)
         cEntry = MaxQueryCount;
 
-    Json::CMutDoc j{};
-    const auto Arr = j.NewArray();
+    auto& rbJson = ApiGetJsonBuffer();
+    CJsonWriter w{ rbJson };
+    w.BeginObject().Key("data").BeginArray();
 
-    constexpr char Sql[]{ R"(
+    // 带游标时从游标处继续，忽略page
+    API_CURSOR Cursor{ LLONG_MIN, 0 };
+    int cRow{};
+    if (!svCursor.empty())
+    {
+        if (!ApiParseCursor(svCursor, Cursor))
+        {
+            rApi = ApiResult::BadPayload;
+            goto Exit;
+        }
+        nPage = 0;
+    }
+
+    // 按Acl主键(user_id, entity_id)的顺序读取，无需另行排序
+    constexpr auto& Sql = TKK_DB_SQL(R"(
 SELECT pg.page_group_id, pg.group_name, pg.create_at
 FROM PageGroup AS pg
 JOIN Acl AS a
 ON a.entity_id = pg.page_group_id
 WHERE
-    a.user_id = ? AND
-    (a.access & ?) != 0
-ORDER BY pg.page_group_id ASC
-LIMIT ? OFFSET ?;
-)" };
+    a.user_id = ?1 AND
+    (a.access & ?2) != 0 AND
+    a.entity_id > ?5
+ORDER BY a.entity_id ASC
+LIMIT ?3 OFFSET ?4;
+)");
     sqlite3_stmt* pStmt;
-    r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-        EckStrAndLen(Sql), 0, &pStmt, nullptr);
+    r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
     if (r == SQLITE_OK)
     {
         sqlite3_bind_int(pStmt, 1, CkDbGetCurrentPseudoUser(Ctx));
         sqlite3_bind_int(pStmt, 2, int(DbAccess::ReadContent | DbAccess::FullControl));
         sqlite3_bind_int(pStmt, 3, cEntry);
         sqlite3_bind_int(pStmt, 4, nPage * cEntry);
+        sqlite3_bind_int64(pStmt, 5, Cursor.k1);
         while ((r = sqlite3_step(pStmt)) == SQLITE_ROW)
         {
-            const auto Obj = j.NewObject();
-            Obj = {
-                "page_group_id", sqlite3_column_int(pStmt, 0),
-                "group_name", SuColumnStringView(pStmt, 1),
-                "create_at", sqlite3_column_int64(pStmt, 2),
-            };
-            Arr.ArrPushBack(Obj);
+            Cursor = { sqlite3_column_int64(pStmt, 0) };
+            ++cRow;
+            w.BeginObject()
+                .Member("page_group_id", sqlite3_column_int(pStmt, 0))
+                .Member("group_name", SuColumnStringView(pStmt, 1))
+                .Member("create_at", sqlite3_column_int64(pStmt, 2))
+                .EndObject();
         }
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
         if (r == SQLITE_DONE)
             r = SQLITE_OK;
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
-        pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
-
-    j = {
-        "r", r == SQLITE_OK ? rApi : ApiResult::Database,
-        "r2", r,
-        "err_msg", pszErrMsg,
-        "data", Arr
-    };
-    ApiSendResponseJson(Ctx, j);
+        pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
+Exit:
+    w.EndArray();
+    ApiWriteNextCursor(w, cRow == cEntry, Cursor);
+    w.Member("r", r == SQLITE_OK ? rApi : ApiResult::Database)
+        .Member("r2", r)
+        .Member("err_msg", pszErrMsg)
+        .EndObject();
+    ApiSendResponseJson(Ctx, rbJson);
 }
 TKK_API_DEF_ENTRY(ApiGet_PageGroupList, AwGetPageGroupList)
\ No newline at end of file
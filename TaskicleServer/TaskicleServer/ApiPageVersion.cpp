@@ -100,27 +100,30 @@ static int PrhDecompressContent(const eck::CRefBin& rbBody, eck::CRefBin& rbCont
 
 static BOOL PageDbExists(sqlite3* pSqlite, int iPageId, _Out_ int& r) noexcept
 {
-    constexpr char Sql[]{ R"(SELECT COUNT(*) FROM Page WHERE page_id = ?)" };
+    constexpr auto& Sql = TKK_DB_SQL(R"(SELECT COUNT(*) FROM Page WHERE page_id = ?)");
     sqlite3_stmt* pStmt;
-    r = sqlite3_prepare_v3(pSqlite, EckStrAndLen(Sql), 0, &pStmt, nullptr);
+    r = DbPrepare(pSqlite, Sql, pStmt);
     if (r != SQLITE_OK)
         return FALSE;
     sqlite3_bind_int(pStmt, 1, iPageId);
     r = sqlite3_step(pStmt);
     if (r != SQLITE_ROW)
+    {
+        DbFinalize(pStmt);
         return FALSE;
+    }
     r = SQLITE_OK;
     const auto b = !!sqlite3_column_int(pStmt, 0);
-    sqlite3_finalize(pStmt);
+    DbFinalize(pStmt);
     return b;
 }
 
 static int PageDbMarkDraft(sqlite3* pSqlite, int iPageId, BOOL bDraft) noexcept
 {
     int r;
-    constexpr char Sql[]{ R"(UPDATE Page SET has_draft = ? WHERE page_id = ?)" };
+    constexpr auto& Sql = TKK_DB_SQL(R"(UPDATE Page SET has_draft = ? WHERE page_id = ?)");
     sqlite3_stmt* pStmt;
-    r = sqlite3_prepare_v3(pSqlite, EckStrAndLen(Sql), 0, &pStmt, nullptr);
+    r = DbPrepare(pSqlite, Sql, pStmt);
     if (r != SQLITE_OK)
         return r;
     sqlite3_bind_int(pStmt, 1, !!bDraft);
@@ -128,24 +131,27 @@ static int PageDbMarkDraft(sqlite3* pSqlite, int iPageId, BOOL bDraft) noexcept
     r = sqlite3_step(pStmt);
     if (r == SQLITE_DONE)
         r = SQLITE_OK;
-    sqlite3_finalize(pStmt);
+    DbFinalize(pStmt);
     return r;
 }
 
 static BOOL PageDbDraftExists(sqlite3* pSqlite, int iPageId, _Out_ int& r) noexcept
 {
-    constexpr char Sql[]{ R"(SELECT COUNT(*) FROM Page WHERE page_id = ? AND has_draft = 1)" };
+    constexpr auto& Sql = TKK_DB_SQL(R"(SELECT COUNT(*) FROM Page WHERE page_id = ? AND has_draft = 1)");
     sqlite3_stmt* pStmt;
-    r = sqlite3_prepare_v3(pSqlite, EckStrAndLen(Sql), 0, &pStmt, nullptr);
+    r = DbPrepare(pSqlite, Sql, pStmt);
     if (r != SQLITE_OK)
         return FALSE;
     sqlite3_bind_int(pStmt, 1, iPageId);
     r = sqlite3_step(pStmt);
     if (r != SQLITE_ROW)
+    {
+        DbFinalize(pStmt);
         return FALSE;
+    }
     r = SQLITE_OK;
     const auto b = !!sqlite3_column_int(pStmt, 0);
-    sqlite3_finalize(pStmt);
+    DbFinalize(pStmt);
     return b;
 }
 
@@ -177,7 +183,7 @@ static void AwSavePage(const API_CTX& Ctx) noexcept
             goto Exit;
         }
         // 如果此页面不存在，视为无效请求
-        if (!PageDbExists(Ctx.pExtra->pSqlite, pHdr->iPageId, rTmp))
+        if (!PageDbExists(Ctx.pSqlite, pHdr->iPageId, rTmp))
         {
             rApi = ApiResult::NotFound;
             r = (NTSTATUS)rTmp;
@@ -220,8 +226,8 @@ static void AwSavePage(const API_CTX& Ctx) noexcept
             pszErrMsg = "CNtTransaction::Create failed";
             goto Exit;
         }
-        CSqliteTransaction TxDbMain{ Ctx.pExtra->pSqlite };
-        CSqliteTransaction TxDb{ Ctx.pExtra->pSqlitePv,TRUE };
+        CSqliteTransaction TxDbMain{ Ctx.pSqlite };
+        CSqliteTransaction TxDb{ Ctx.pSqlitePv,TRUE };
 
         if (pHdr->bTemp)// 保存草稿
         {
@@ -232,17 +238,17 @@ static void AwSavePage(const API_CTX& Ctx) noexcept
                 pszErrMsg = "DiffSaveFile failed";
                 goto Exit;
             }
-            rTmp = PageDbMarkDraft(Ctx.pExtra->pSqlite, pHdr->iPageId, TRUE);
+            rTmp = PageDbMarkDraft(Ctx.pSqlite, pHdr->iPageId, TRUE);
             if (rTmp != SQLITE_OK)
             {
                 rApi = ApiResult::Database;
-                pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+                pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
                 goto Exit;
             }
         }
         else// 创建一个版本
         {
-            r = DiffDbCreateVersion(Ctx.pExtra->pSqlitePv, TxFile,
+            r = DiffDbCreateVersion(Ctx.pSqlitePv, TxFile,
                 Dir.Get(), pHdr->iPageId, iUserId, rbContent, rTmp);
             if (!NT_SUCCESS(r))
             {
@@ -254,16 +260,24 @@ static void AwSavePage(const API_CTX& Ctx) noexcept
                 else
                 {
                     rApi = ApiResult::Database;
-                    pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlitePv);
+                    pszErrMsg = sqlite3_errmsg(Ctx.pSqlitePv);
                 }
                 goto Exit;
             }
             // 保存后删除草稿
-            rTmp = PageDbMarkDraft(Ctx.pExtra->pSqlite, pHdr->iPageId, FALSE);
+            rTmp = PageDbMarkDraft(Ctx.pSqlite, pHdr->iPageId, FALSE);
             if (rTmp != SQLITE_OK)
             {
                 rApi = ApiResult::Database;
-                pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+                pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
+                goto Exit;
+            }
+            rTmp = DbContentFtsSetPage(Ctx.pSqlite, pHdr->iPageId,
+                { (PCSTR)rbContent.Data(), rbContent.Size() });
+            if (rTmp != SQLITE_OK)
+            {
+                rApi = ApiResult::Database;
+                pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
                 goto Exit;
             }
         }
@@ -295,11 +309,9 @@ static void AwLoadPage(const API_CTX& Ctx) noexcept
     pHdr->Magic = PrhMagic;
     pHdr->eType = DbPageType::Markdown;// 目前仅支持Markdown
 
-    std::vector<QUERY_KV> vKv{};
-    ApiParseQueryString(Ctx, vKv);
     int iPageId{ DbIdInvalid };
     BOOL bTemp{};
-    for (const auto& e : vKv)
+    for (const auto& e : ApiGetQuery(Ctx))
     {
         if (TKK_API_HIT_QUERY("page_id"))
             eck::TcsToInt(e.V.data(), e.V.size(), iPageId, 10);
@@ -350,7 +362,7 @@ static void AwLoadPage(const API_CTX& Ctx) noexcept
         }
         if (bTemp)
         {
-            bTemp = PageDbDraftExists(Ctx.pExtra->pSqlite, iPageId, rTmp);
+            bTemp = PageDbDraftExists(Ctx.pSqlite, iPageId, rTmp);
             if (rTmp != SQLITE_OK)
             {
                 pHdr->r = ApiResult::Database;
@@ -392,15 +404,16 @@ static void AwGetPageVersionList(const API_CTX& Ctx) noexcept
     int r{};
     PCSTR pszErrMsg{};
 
-    std::vector<QUERY_KV> vKv{};
-    ApiParseQueryString(Ctx, vKv);
     int cEntry{}, nPage{}, iPageId{ DbIdInvalid };
-    for (const auto& e : vKv)
+    std::string_view svCursor{};
+    for (const auto& e : ApiGetQuery(Ctx))
     {
         if (TKK_API_HIT_QUERY("count"))
             ApiParseInt(e.V, cEntry);
         else if (TKK_API_HIT_QUERY("page"))
             ApiParseInt(e.V, nPage);
+        else if (TKK_API_HIT_QUERY("cursor"))
+            svCursor = e.V;
         else if (TKK_API_HIT_QUERY("page_id"))
             ApiParseInt(e.V, iPageId);
     }
@@ -408,8 +421,22 @@ static void AwGetPageVersionList(const API_CTX& Ctx) noexcept
     if (cEntry <= 0 || cEntry > MaxQueryCount)
         cEntry = MaxQueryCount;
 
-    Json::CMutDoc j{};
-    const auto Arr = j.NewArray();
+    auto& rbJson = ApiGetJsonBuffer();
+    CJsonWriter w{ rbJson };
+    w.BeginObject().Key("data").BeginArray();
+
+    // 带游标时从游标处继续，忽略page
+    API_CURSOR Cursor{ LLONG_MAX, 0 };
+    int cRow{};
+    if (!svCursor.empty())
+    {
+        if (!ApiParseCursor(svCursor, Cursor))
+        {
+            rApi = ApiResult::BadPayload;
+            goto Exit;
+        }
+        nPage = 0;
+    }
 
     if (iPageId != DbIdInvalid)
     {
@@ -420,50 +447,49 @@ static void AwGetPageVersionList(const API_CTX& Ctx) noexcept
             goto Exit;
         }
 
-        constexpr char Sql[]{ R"(
+        constexpr auto& Sql = TKK_DB_PV_SQL(R"(
 SELECT ver_id, user_id, create_at, description FROM PageVersion
-WHERE page_id = ?
+WHERE page_id = ?1 AND ver_id < ?4
 ORDER BY ver_id DESC
-LIMIT ? OFFSET ?
-)" };
+LIMIT ?2 OFFSET ?3
+)");
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlitePv,
-            EckStrAndLen(Sql), 0, &pStmt, nullptr);
+        r = DbPrepare(Ctx.pSqlitePv, Sql, pStmt);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlitePv);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlitePv);
             goto Exit;
         }
         sqlite3_bind_int(pStmt, 1, iPageId);
         sqlite3_bind_int(pStmt, 2, cEntry);
         sqlite3_bind_int(pStmt, 3, nPage * cEntry);
+        sqlite3_bind_int64(pStmt, 4, Cursor.k1);
         while ((r = sqlite3_step(pStmt)) == SQLITE_ROW)
         {
-            const auto Obj = j.NewObject();
-            Obj = {
-                "ver_id", sqlite3_column_int(pStmt, 0),
-                "user_id", sqlite3_column_int(pStmt, 1),
-                "create_at", sqlite3_column_int64(pStmt, 2),
-                "description", SuColumnStringView(pStmt, 3)
-            };
-            Arr.ArrPushBack(Obj);
+            Cursor = { sqlite3_column_int64(pStmt, 0) };
+            ++cRow;
+            w.BeginObject()
+                .Member("ver_id", sqlite3_column_int(pStmt, 0))
+                .Member("user_id", sqlite3_column_int(pStmt, 1))
+                .Member("create_at", sqlite3_column_int64(pStmt, 2))
+                .EndObject();
         }
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
         if (r == SQLITE_DONE)
             r = SQLITE_OK;
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlitePv);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlitePv);
     }
     else
         rApi = ApiResult::RequiredFieldMissing;
 Exit:
-    j = {
-        "r", r == SQLITE_OK ? rApi : ApiResult::Database,
-        "r2", r,
-        "err_msg", pszErrMsg,
-        "data", Arr
-    };
-    ApiSendResponseJson(Ctx, j);
+    w.EndArray();
+    ApiWriteNextCursor(w, cRow == cEntry, Cursor);
+    w.Member("r", r == SQLITE_OK ? rApi : ApiResult::Database)
+        .Member("r2", r)
+        .Member("err_msg", pszErrMsg)
+        .EndObject();
+    ApiSendResponseJson(Ctx, rbJson);
 }
 TKK_API_DEF_ENTRY(ApiGet_PageVersionList, AwGetPageVersionList)
 
@@ -476,10 +502,8 @@ static void AwGetPageVersionContent(const API_CTX& Ctx) noexcept
     pHdr->Magic = PrhMagic;
     pHdr->eType = DbPageType::Markdown;// 目前仅支持Markdown
 
-    std::vector<QUERY_KV> vKv{};
-    ApiParseQueryString(Ctx, vKv);
     int iPageId{ DbIdInvalid }, iVerId{ DbIdInvalid };
-    for (const auto& e : vKv)
+    for (const auto& e : ApiGetQuery(Ctx))
     {
         if (TKK_API_HIT_QUERY("page_id"))
             ApiParseInt(e.V, iPageId);
@@ -527,7 +551,7 @@ static void AwGetPageVersionContent(const API_CTX& Ctx) noexcept
         }
 
         eck::CRefBin rbFile{};
-        nts = DiffDbGetVersionContent(Ctx.pExtra->pSqlitePv, TxFile, Dir.Get(),
+        nts = DiffDbGetVersionContent(Ctx.pSqlitePv, TxFile, Dir.Get(),
             iPageId, iVerId, rbFile, rTmp);
         if (!NT_SUCCESS(nts))
         {
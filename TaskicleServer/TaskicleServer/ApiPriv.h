@@ -1,36 +1,56 @@
 ﻿#pragma once
-struct QUERY_KV
-{
-    std::string_view K{};
-    std::string_view V{};
-};
+#include "JsonWriter.h"
 
 #define TKK_API_HIT_QUERY(x) eck::TcsEqualLen2I(e.K.data(), e.K.size(), EckStrAndLen(x))
 
-#define TKK_API_DEF_ENTRY(Name, Worker)                 \
-    EnHttpParseResult Name(const API_CTX& Ctx) noexcept \
-    {                                   \
-        Ctx.pExtra->IncRef();           \
-        eck::TpSubmitSimpleCallback(nullptr, [Ctx](PTP_CALLBACK_INSTANCE) noexcept \
-            {                           \
-                if (ApiPreAction(Ctx))  \
-                    Worker(Ctx);        \
-                ApiPostAction(Ctx);     \
-            });                         \
-        return HPR_OK;                  \
+// 定义在线程池中执行的接口入口，调度方已增加连接数据的引用
+#define TKK_API_DEF_ENTRY(Name, Worker)     \
+    void Name(API_CTX& Ctx) noexcept        \
+    {                                       \
+        if (ApiPreAction(Ctx))              \
+        {                                   \
+            Worker(Ctx);                    \
+            ApiPostAction(Ctx);             \
+        }                                   \
+        else                                \
+            Ctx.pExtra->DecRef();           \
     }
 
 constexpr int MaxQueryCount = 50;
 
-BOOL ApiPreAction(const API_CTX& Ctx) noexcept;
+// 取得Ctx.eRes声明的资源，失败时已发送错误响应
+BOOL ApiPreAction(API_CTX& Ctx) noexcept;
+// 归还资源并释放连接数据，仅在ApiPreAction成功后调用
 void ApiPostAction(const API_CTX& Ctx) noexcept;
 
-void ApiParseQueryString(const API_CTX& Ctx, std::vector<QUERY_KV>& vKv) noexcept;
+EckInlineNd std::span<const QUERY_KV> ApiGetQuery(const API_CTX& Ctx) noexcept
+{
+    return { Ctx.Req.Query, Ctx.Req.cQuery };
+}
+// 解码URL编码的查询参数，无需解码时直接返回sv，否则解码到Buf
+// Buf空间不足或编码无效时返回FALSE
+BOOL ApiUrlDecode(std::string_view sv, std::span<char> Buf,
+    _Out_ std::string_view& svResult) noexcept;
+// 键集分页游标，记录上一页最后一行的排序键，对客户端不透明
+struct API_CURSOR
+{
+    LONGLONG k1;
+    LONGLONG k2;
+};
+// 解析cursor参数，格式无效返回FALSE
+BOOL ApiParseCursor(std::string_view sv, _Out_ API_CURSOR& Cursor) noexcept;
+// 写入next_cursor成员，bMore为FALSE时写入null
+void ApiWriteNextCursor(CJsonWriter& w, BOOL bMore, const API_CURSOR& Cursor) noexcept;
 // 仅当解析成功时覆盖i的值
 void ApiParseInt(std::string_view sv, _Inout_ int& i) noexcept;
 
 void ApiSendResponseJson(const API_CTX& Ctx, Json::CMutDoc& j,
     USHORT usStatusCode = 200, const THeader* pHeader = nullptr, size_t cHeader = 0) noexcept;
+// 取本线程复用的JSON输出缓冲区，返回时已清空
+eck::CRefBin& ApiGetJsonBuffer() noexcept;
+// 发送ApiGetJsonBuffer中由CJsonWriter写入的内容
+void ApiSendResponseJson(const API_CTX& Ctx, eck::CRefBin& rbJson,
+    USHORT usStatusCode = 200, const THeader* pHeader = nullptr, size_t cHeader = 0) noexcept;
 void ApiSendResponseBin(const API_CTX& Ctx, std::span<const BYTE> sp,
     USHORT usStatusCode = 200, const THeader* pHeader = nullptr, size_t cHeader = 0) noexcept;
 
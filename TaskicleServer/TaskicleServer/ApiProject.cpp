@@ -22,36 +22,38 @@ static void AwInsertProject(const API_CTX& Ctx) noexcept
 
     if (Json::CDoc jIn{ Ctx.pExtra->rbBody }; jIn.IsValid())
     {
-        constexpr char Sql[]{ R"(
+        constexpr auto& Sql = TKK_DB_SQL(R"(
 INSERT INTO Project(project_id, project_name)
 VALUES ((SELECT id FROM GlobalId), ?);
-)" };
+)");
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-            EckStrAndLen(Sql), 0, &pStmt, nullptr);
+        r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
 
         const auto ValName = jIn["/project_name"];
         SuBindJsonStringValueSafe(pStmt, 1, ValName, "Untitled Project"sv);
 
-        CSqliteTransaction Tx{ Ctx.pExtra->pSqlite };
-        r = DbIncrementId(Ctx.pExtra->pSqlite);
+        CSqliteTransaction Tx{ Ctx.pSqlite };
+        r = DbIncrementId(Ctx.pSqlite);
         if (r == SQLITE_OK)
         {
             r = sqlite3_step(pStmt);
             if (r == SQLITE_DONE)
                 r = AclDbOnEntityCreate(Ctx, iUserId);
         }
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
 
         if (r == SQLITE_OK)
+        {
             Tx.Commit();
+            AclDbFlushInvalidation(Ctx);
+        }
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::BadPayload;
@@ -94,28 +96,30 @@ static void AwDeleteProject(const API_CTX& Ctx) noexcept
             goto Exit;
         }
 
-        constexpr char Sql[]{ R"(DELETE FROM Project WHERE project_id = ?)" };
+        constexpr auto& Sql = TKK_DB_SQL(R"(DELETE FROM Project WHERE project_id = ?)");
 
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-            EckStrAndLen(Sql), 0, &pStmt, nullptr);
+        r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
         sqlite3_bind_int(pStmt, 1, ValId.GetInt());
 
-        CSqliteTransaction Tx{ Ctx.pExtra->pSqlite };
+        CSqliteTransaction Tx{ Ctx.pSqlite };
         r = sqlite3_step(pStmt);
         if (r == SQLITE_DONE)
             r = AclDbOnEntityDelete(Ctx, ValId.GetInt());
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
 
         if (r == SQLITE_OK)
+        {
             Tx.Commit();
+            AclDbFlushInvalidation(Ctx);
+        }
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::BadPayload;
@@ -158,23 +162,22 @@ static void AwUpdateProject(const API_CTX& Ctx) noexcept
             rApi = ApiResult::AccessDenied;
             goto Exit;
         }
-        constexpr char Sql[]{ R"(UPDATE Project SET project_name = ? WHERE project_id = ?)" };
+        constexpr auto& Sql = TKK_DB_SQL(R"(UPDATE Project SET project_name = ? WHERE project_id = ?)");
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-            EckStrAndLen(Sql), 0, &pStmt, nullptr);
+        r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
         SuBindJsonStringValue(pStmt, 1, ValName);
         sqlite3_bind_int(pStmt, 2, ValId.GetInt());
         r = sqlite3_step(pStmt);
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
         if (r == SQLITE_DONE)
             r = SQLITE_OK;
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::BadPayload;
@@ -196,67 +199,84 @@ static void AwGetProjectList(const API_CTX& Ctx) noexcept
     int r{};
     PCSTR pszErrMsg{};
 
-    std::vector<QUERY_KV> vKv{};
-    ApiParseQueryString(Ctx, vKv);
     int cEntry{}, nPage{};
-    for (const auto& e : vKv)
+    std::string_view svCursor{};
+    for (const auto& e : ApiGetQuery(Ctx))
     {
         if (TKK_API_HIT_QUERY("count"))
             ApiParseInt(e.V, cEntry);
         else if (TKK_API_HIT_QUERY("page"))
             ApiParseInt(e.V, nPage);
+        else if (TKK_API_HIT_QUERY("cursor"))
+            svCursor = e.V;
     }
     if (cEntry <= 0 || cEntry > MaxQueryCount)
         cEntry = MaxQueryCount;
 
-    Json::CMutDoc j{};
-    const auto Arr = j.NewArray();
+    auto& rbJson = ApiGetJsonBuffer();
+    CJsonWriter w{ rbJson };
+    w.BeginObject().Key("data").BeginArray();
+
+    // 带游标时从游标处继续，忽略page
+    API_CURSOR Cursor{ LLONG_MIN, 0 };
+    int cRow{};
+    if (!svCursor.empty())
+    {
+        if (!ApiParseCursor(svCursor, Cursor))
+        {
+            rApi = ApiResult::BadPayload;
+            goto Exit;
+        }
+        nPage = 0;
+    }
 
-    constexpr char Sql[]{ R"(
+    // 按Acl主键(user_id, entity_id)的顺序读取，无需另行排序
+    constexpr auto& Sql = TKK_DB_SQL(R"(
 SELECT p.project_id, p.project_name, p.create_at
 FROM Project AS p
 JOIN Acl AS a
 ON a.entity_id = p.project_id
 WHERE
-    a.user_id = ? AND
-    (a.access & ?) != 0
-ORDER BY p.project_id ASC
-LIMIT ? OFFSET ?;
-)" };
+    a.user_id = ?1 AND
+    (a.access & ?2) != 0 AND
+    a.entity_id > ?5
+ORDER BY a.entity_id ASC
+LIMIT ?3 OFFSET ?4;
+)");
     sqlite3_stmt* pStmt;
-    r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-        EckStrAndLen(Sql), 0, &pStmt, nullptr);
+    r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
     if (r != SQLITE_OK)
     {
-        pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+        pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
         goto Exit;
     }
     sqlite3_bind_int(pStmt, 1, CkDbGetCurrentPseudoUser(Ctx));
     sqlite3_bind_int(pStmt, 2, int(DbAccess::ReadContent | DbAccess::FullControl));
     sqlite3_bind_int(pStmt, 3, cEntry);
     sqlite3_bind_int(pStmt, 4, nPage * cEntry);
+    sqlite3_bind_int64(pStmt, 5, Cursor.k1);
     while ((r = sqlite3_step(pStmt)) == SQLITE_ROW)
     {
-        const auto Obj = j.NewObject();
-        Obj = {
-            "project_id", sqlite3_column_int(pStmt, 0),
-            "project_name", SuColumnStringView(pStmt, 1),
-            "create_at", sqlite3_column_int64(pStmt, 2),
-        };
-        Arr.ArrPushBack(Obj);
+        Cursor = { sqlite3_column_int64(pStmt, 0) };
+        ++cRow;
+        w.BeginObject()
+            .Member("project_id", sqlite3_column_int(pStmt, 0))
+            .Member("project_name", SuColumnStringView(pStmt, 1))
+            .Member("create_at", sqlite3_column_int64(pStmt, 2))
+            .EndObject();
     }
-    sqlite3_finalize(pStmt);
+    DbFinalize(pStmt);
     if (r == SQLITE_DONE)
         r = SQLITE_OK;
     else
-        pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+        pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
 Exit:
-    j = {
-        "r", ApiResult::Ok,
-        "r2", r,
-        "err_msg", pszErrMsg,
-        "data", Arr
-    };
-    ApiSendResponseJson(Ctx, j);
+    w.EndArray();
+    ApiWriteNextCursor(w, cRow == cEntry, Cursor);
+    w.Member("r", r == SQLITE_OK ? rApi : ApiResult::Database)
+        .Member("r2", r)
+        .Member("err_msg", pszErrMsg)
+        .EndObject();
+    ApiSendResponseJson(Ctx, rbJson);
 }
 TKK_API_DEF_ENTRY(ApiGet_ProjectList, AwGetProjectList)
\ No newline at end of file
@@ -5,107 +5,282 @@
 #include "SqliteUtils.h"
 #include "AccessCheck.h"
 
+constexpr static size_t MaxKeywordLength = 256;// 解码后的字节数
+// 片段包含的词元数，CJK文字每字约一个词元
+constexpr static int SnippetTokenCount = 24;
+
 static void AwSearchEntity(const API_CTX& Ctx) noexcept
 {
     ApiResult rApi{ ApiResult::Ok };
     int r{};
     PCSTR pszErrMsg{};
 
-    std::vector<QUERY_KV> vKv{};
-    ApiParseQueryString(Ctx, vKv);
     int cEntry{}, nPage{};
+    std::string_view svCursor{};
     std::string_view svKeyword{};
-    for (const auto& e : vKv)
+    for (const auto& e : ApiGetQuery(Ctx))
     {
         if (TKK_API_HIT_QUERY("count"))
             ApiParseInt(e.V, cEntry);
         else if (TKK_API_HIT_QUERY("page"))
             ApiParseInt(e.V, nPage);
+        else if (TKK_API_HIT_QUERY("cursor"))
+            svCursor = e.V;
         else if (TKK_API_HIT_QUERY("keyword"))
             svKeyword = e.V;
     }
     if (cEntry <= 0 || cEntry > MaxQueryCount)
         cEntry = MaxQueryCount;
 
-    Json::CMutDoc j{};
-    const auto Arr = j.NewArray();
+    auto& rbJson = ApiGetJsonBuffer();
+    CJsonWriter w{ rbJson };
+    w.BeginObject().Key("data").BeginArray();
+
+    // 带游标时从游标处继续，忽略page
+    API_CURSOR Cursor{};
+    int cRow{};
+    if (!svCursor.empty())
+    {
+        if (!ApiParseCursor(svCursor, Cursor))
+        {
+            rApi = ApiResult::BadPayload;
+            goto Exit;
+        }
+        nPage = 0;
+    }
 
     if (!svKeyword.empty())
     {
-        constexpr char Sql[]{ R"(
-SELECT * FROM (
-    SELECT s.entity_id, s.type, s.name, s.create_at, s.container_id
-    FROM CoreEntity s
-    JOIN Acl a ON a.entity_id = s.entity_id
-    WHERE
-        a.user_id = ?
-        AND (a.access & ?) != 0
+        char chDecoded[MaxKeywordLength];
+        std::string_view svDecoded;
+        if (!ApiUrlDecode(svKeyword, chDecoded, svDecoded))
+        {
+            rApi = ApiResult::BadPayload;
+            goto Exit;
+        }
+        eck::CRefStrA rsMatch{};
+        SuMakeFtsPrefixQuery(svDecoded, rsMatch);
+        if (rsMatch.IsEmpty())
+        {
+            rApi = ApiResult::RequiredFieldMissing;
+            goto Exit;
+        }
+
+        // 先由全文索引取得按相关度排序的候选，再按权限过滤
+        // 关键字为数字时额外匹配该ID的实体或用户，排在最前
+        constexpr auto& Sql = TKK_DB_SQL(R"(
+WITH Hit AS (
+    SELECT rowid AS fts_id, type, name, create_at, container_id, bm25(EntityFts) AS score
+    FROM EntityFts
+    WHERE EntityFts MATCH ?3
 UNION ALL
-    SELECT
-        user_id     AS entity_id,
-        5           AS type,
-        user_name   AS name,
-        create_at,
-        -1          AS container_id
-    FROM User
-) AS combined
+    SELECT rowid, type, name, create_at, container_id, -1e300
+    FROM EntityFts
+    WHERE ?4 IS NOT NULL AND rowid IN (?4, -?4)
+)
+SELECT abs(h.fts_id), h.type, h.name, h.create_at, h.container_id, min(h.score) AS best_score, h.fts_id
+FROM Hit AS h
+LEFT JOIN Acl AS a ON a.user_id = ?1 AND a.entity_id = h.fts_id
+LEFT JOIN Acl AS c ON c.user_id = ?1 AND c.entity_id = h.container_id
 WHERE
-    (name LIKE ? OR entity_id = ?)
-ORDER BY entity_id
-LIMIT ? OFFSET ?;
-)" };
+    h.type = 5 OR
+    CASE WHEN a.access IS NULL
+        THEN (c.access & ?2) != 0
+        ELSE (a.access & ?2) != 0
+    END
+GROUP BY h.fts_id
+HAVING ?7 IS NULL OR (best_score, h.fts_id) > (?7, ?8)
+ORDER BY best_score, h.fts_id
+LIMIT ?5 OFFSET ?6;
+)");
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-            EckStrAndLen(Sql), 0, &pStmt, nullptr);
+        r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
         sqlite3_bind_int(pStmt, 1, CkDbGetCurrentPseudoUser(Ctx));
         sqlite3_bind_int(pStmt, 2, int(DbAccess::ReadContent | DbAccess::FullControl));
-
-        eck::CRefStrA rsDecoded{};
-        eck::UrlDecode(svKeyword.data(), (int)svKeyword.size(), rsDecoded);
-        eck::CRefStrA rsKeyword{};
-        rsKeyword.PushBackChar('%');
-        SuEscapeLikeQuery(rsDecoded.ToStringView(), rsKeyword);
-        rsKeyword.PushBackChar('%');
-        sqlite3_bind_text(pStmt, 3, rsKeyword.Data(), rsKeyword.Size(), nullptr);
+        sqlite3_bind_text(pStmt, 3, rsMatch.Data(), rsMatch.Size(), nullptr);
 
         int iKeywordAsId = DbIdInvalid;
-        ApiParseInt(svKeyword, iKeywordAsId);
-        sqlite3_bind_int(pStmt, 4, iKeywordAsId);
+        ApiParseInt(svDecoded, iKeywordAsId);
+        if (iKeywordAsId > 0)
+            sqlite3_bind_int(pStmt, 4, iKeywordAsId);
+        else
+            sqlite3_bind_null(pStmt, 4);
 
         sqlite3_bind_int(pStmt, 5, cEntry);
         sqlite3_bind_int(pStmt, 6, nPage * cEntry);
+        // 游标为上一页最后一行的相关度与索引行ID
+        if (svCursor.empty())
+            sqlite3_bind_null(pStmt, 7);
+        else
+            sqlite3_bind_double(pStmt, 7, std::bit_cast<double>(Cursor.k1));
+        sqlite3_bind_int64(pStmt, 8, Cursor.k2);
+        while ((r = sqlite3_step(pStmt)) == SQLITE_ROW)
+        {
+            Cursor = {
+                std::bit_cast<LONGLONG>(sqlite3_column_double(pStmt, 5)),
+                sqlite3_column_int64(pStmt, 6) };
+            ++cRow;
+            w.BeginObject()
+                .Member("entity_id", sqlite3_column_int(pStmt, 0))
+                .Member("type", sqlite3_column_int(pStmt, 1))
+                .Member("name", SuColumnStringView(pStmt, 2))
+                .Member("create_at", sqlite3_column_int64(pStmt, 3))
+                .Member("container_id", sqlite3_column_int(pStmt, 4))
+                .EndObject();
+        }
+        DbFinalize(pStmt);
+        if (r == SQLITE_DONE)
+            r = SQLITE_OK;
+        else
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
+    }
+    else
+        rApi = ApiResult::RequiredFieldMissing;
+Exit:
+    w.EndArray();
+    ApiWriteNextCursor(w, cRow == cEntry, Cursor);
+    w.Member("r", r == SQLITE_OK ? rApi : ApiResult::Database)
+        .Member("r2", r)
+        .Member("err_msg", pszErrMsg)
+        .EndObject();
+    ApiSendResponseJson(Ctx, rbJson);
+}
+TKK_API_DEF_ENTRY(ApiGet_SearchEntity, AwSearchEntity)
+
+static void AwSearchContent(const API_CTX& Ctx) noexcept
+{
+    ApiResult rApi{ ApiResult::Ok };
+    int r{};
+    PCSTR pszErrMsg{};
+
+    int cEntry{}, nPage{};
+    std::string_view svCursor{};
+    std::string_view svKeyword{};
+    for (const auto& e : ApiGetQuery(Ctx))
+    {
+        if (TKK_API_HIT_QUERY("count"))
+            ApiParseInt(e.V, cEntry);
+        else if (TKK_API_HIT_QUERY("page"))
+            ApiParseInt(e.V, nPage);
+        else if (TKK_API_HIT_QUERY("cursor"))
+            svCursor = e.V;
+        else if (TKK_API_HIT_QUERY("keyword"))
+            svKeyword = e.V;
+    }
+    if (cEntry <= 0 || cEntry > MaxQueryCount)
+        cEntry = MaxQueryCount;
+
+    auto& rbJson = ApiGetJsonBuffer();
+    CJsonWriter w{ rbJson };
+    w.BeginObject().Key("data").BeginArray();
+
+    API_CURSOR Cursor{};
+    int cRow{};
+    if (!svCursor.empty())
+    {
+        if (!ApiParseCursor(svCursor, Cursor))
+        {
+            rApi = ApiResult::BadPayload;
+            goto Exit;
+        }
+        nPage = 0;
+    }
+
+    if (!svKeyword.empty())
+    {
+        char chDecoded[MaxKeywordLength];
+        std::string_view svDecoded;
+        if (!ApiUrlDecode(svKeyword, chDecoded, svDecoded))
+        {
+            rApi = ApiResult::BadPayload;
+            goto Exit;
+        }
+        eck::CRefStrA rsMatch{};
+        SuMakeFtsPrefixQuery(svDecoded, rsMatch);
+        if (rsMatch.IsEmpty())
+        {
+            rApi = ApiResult::RequiredFieldMissing;
+            goto Exit;
+        }
+
+        // 正文所属实体的名称、类型与容器取自Entity，权限按实体及其容器检查
+        // 片段中命中的词以U+0002和U+0003包围，由前端转义后替换为高亮标记
+        constexpr auto& Sql = TKK_DB_SQL(R"(
+SELECT c.kind, c.entity_id, e.type, e.name, e.container_id, c.rowid >> 2,
+    snippet(ContentFts, 0, char(2), char(3), '…', ?6), c.rank, c.rowid
+FROM ContentFts AS c
+JOIN Entity AS e ON e.entity_id = c.entity_id
+LEFT JOIN Acl AS a ON a.user_id = ?1 AND a.entity_id = c.entity_id
+LEFT JOIN Acl AS p ON p.user_id = ?1 AND p.entity_id = e.container_id
+WHERE
+    ContentFts MATCH ?3 AND
+    (?7 IS NULL OR (c.rank, c.rowid) > (?7, ?8)) AND
+    CASE WHEN a.access IS NULL
+        THEN (p.access & ?2) != 0
+        ELSE (a.access & ?2) != 0
+    END
+ORDER BY c.rank, c.rowid
+LIMIT ?4 OFFSET ?5;
+)");
+        sqlite3_stmt* pStmt;
+        r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
+        if (r != SQLITE_OK)
+        {
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
+            goto Exit;
+        }
+        sqlite3_bind_int(pStmt, 1, CkDbGetCurrentPseudoUser(Ctx));
+        sqlite3_bind_int(pStmt, 2, int(DbAccess::ReadContent | DbAccess::FullControl));
+        sqlite3_bind_text(pStmt, 3, rsMatch.Data(), rsMatch.Size(), nullptr);
+        sqlite3_bind_int(pStmt, 4, cEntry);
+        sqlite3_bind_int(pStmt, 5, nPage * cEntry);
+        sqlite3_bind_int(pStmt, 6, SnippetTokenCount);
+        // 游标为上一页最后一行的相关度与索引行ID
+        if (svCursor.empty())
+            sqlite3_bind_null(pStmt, 7);
+        else
+            sqlite3_bind_double(pStmt, 7, std::bit_cast<double>(Cursor.k1));
+        sqlite3_bind_int64(pStmt, 8, Cursor.k2);
         while ((r = sqlite3_step(pStmt)) == SQLITE_ROW)
         {
-            const auto Obj = j.NewObject();
-            Obj = {
-                "entity_id", sqlite3_column_int(pStmt, 0),
-                "type", sqlite3_column_int(pStmt, 1),
-                "name", SuColumnStringView(pStmt, 2),
-                "create_at", sqlite3_column_int64(pStmt, 3),
-                "container_id", sqlite3_column_int(pStmt, 4),
-            };
-            Arr.ArrPushBack(Obj);
+            Cursor = {
+                std::bit_cast<LONGLONG>(sqlite3_column_double(pStmt, 7)),
+                sqlite3_column_int64(pStmt, 8) };
+            ++cRow;
+            const auto eKind = (DbContentKind)sqlite3_column_int(pStmt, 0);
+            w.BeginObject()
+                .Member("kind", eKind)
+                .Member("entity_id", sqlite3_column_int(pStmt, 1))
+                .Member("type", sqlite3_column_int(pStmt, 2))
+                .Member("name", SuColumnStringView(pStmt, 3))
+                .Member("container_id", sqlite3_column_int(pStmt, 4));
+            if (eKind == DbContentKind::TaskComment)
+                w.Member("comm_id", sqlite3_column_int(pStmt, 5));
+            else
+                w.Key("comm_id").Null();
+            w.Member("snippet", SuColumnStringView(pStmt, 6))
+                .EndObject();
         }
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
         if (r == SQLITE_DONE)
             r = SQLITE_OK;
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::RequiredFieldMissing;
 Exit:
-    j = {
-        "r", r == SQLITE_OK ? rApi : ApiResult::Database,
-        "r2", r,
-        "err_msg", pszErrMsg,
-        "data", Arr
-    };
-    ApiSendResponseJson(Ctx, j);
+    w.EndArray();
+    ApiWriteNextCursor(w, cRow == cEntry, Cursor);
+    w.Member("r", r == SQLITE_OK ? rApi : ApiResult::Database)
+        .Member("r2", r)
+        .Member("err_msg", pszErrMsg)
+        .EndObject();
+    ApiSendResponseJson(Ctx, rbJson);
 }
-TKK_API_DEF_ENTRY(ApiGet_SearchEntity, AwSearchEntity)
\ No newline at end of file
+TKK_API_DEF_ENTRY(ApiGet_SearchContent, AwSearchContent)
\ No newline at end of file
@@ -97,11 +97,11 @@ static void AwInsertTask(const API_CTX& Ctx) noexcept
         rsSql.PushBack(EckStrAndLen(");"));
 
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
+        r = sqlite3_prepare_v3(Ctx.pSqlite,
             rsSql.Data(), rsSql.Size(), 0, &pStmt, nullptr);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
         // 绑定
@@ -130,20 +130,23 @@ static void AwInsertTask(const API_CTX& Ctx) noexcept
         if (tExpire)
             sqlite3_bind_int64(pStmt, idxCol++, tExpire);
 
-        CSqliteTransaction Tx{ Ctx.pExtra->pSqlite };
-        r = DbIncrementId(Ctx.pExtra->pSqlite);
+        CSqliteTransaction Tx{ Ctx.pSqlite };
+        r = DbIncrementId(Ctx.pSqlite);
         if (r == SQLITE_OK)
         {
             r = sqlite3_step(pStmt);
             if (r == SQLITE_DONE)
-                r = AclDbOnEntityCreate(Ctx, iUserId);
+                r = AclDbOnEntityCreate(Ctx, iUserId, ValProjId.GetInt());
         }
         sqlite3_finalize(pStmt);
 
         if (r == SQLITE_OK)
+        {
             Tx.Commit();
+            AclDbFlushInvalidation(Ctx);
+        }
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::BadPayload;
@@ -186,27 +189,29 @@ static void AwDeleteTask(const API_CTX& Ctx) noexcept
             goto Exit;
         }
 
-        constexpr char Sql[]{ R"(DELETE FROM Task WHERE task_id = ?)" };
+        constexpr auto& Sql = TKK_DB_SQL(R"(DELETE FROM Task WHERE task_id = ?)");
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-            EckStrAndLen(Sql), 0, &pStmt, nullptr);
+        r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
         sqlite3_bind_int(pStmt, 1, ValId.GetInt());
 
-        CSqliteTransaction Tx{ Ctx.pExtra->pSqlite };
+        CSqliteTransaction Tx{ Ctx.pSqlite };
         r = sqlite3_step(pStmt);
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
         if (r == SQLITE_DONE)
             r = AclDbOnEntityDelete(Ctx, ValId.GetInt());
 
         if (r == SQLITE_OK)
+        {
             Tx.Commit();
+            AclDbFlushInvalidation(Ctx);
+        }
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::BadPayload;
@@ -221,34 +226,6 @@ Exit:
 }
 TKK_API_DEF_ENTRY(ApiPost_DeleteTask, AwDeleteTask)
 
-// 返回sqlite错误码
-static int DbSetCurrentUserId(const API_CTX& Ctx, int iUserId) noexcept
-{
-    int r;
-    r = sqlite3_exec(Ctx.pExtra->pSqlite,
-        "CREATE TEMP TABLE IF NOT EXISTS main.TempUserId(user_id INTEGER);",
-        nullptr, nullptr, nullptr);
-    if (r != SQLITE_OK)
-        return r;
-    r = sqlite3_exec(Ctx.pExtra->pSqlite,
-        "DELETE FROM main.TempUserId;",
-        nullptr, nullptr, nullptr);
-    if (r != SQLITE_OK)
-        return r;
-
-    sqlite3_stmt* pStmt;
-    r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-        "INSERT INTO main.TempUserId(user_id) VALUES (?);", -1, 0, &pStmt, nullptr);
-    if (r != SQLITE_OK)
-        return r;
-    sqlite3_bind_int(pStmt, 1, iUserId);
-    r = sqlite3_step(pStmt);
-    sqlite3_finalize(pStmt);
-    if (r == SQLITE_DONE)
-        r = SQLITE_OK;
-    return r;
-}
-
 // Task: WriteContent
 static void AwUpdateTask(const API_CTX& Ctx) noexcept
 {
@@ -278,13 +255,6 @@ static void AwUpdateTask(const API_CTX& Ctx) noexcept
             goto Exit;
         }
 
-        r = DbSetCurrentUserId(Ctx, iUserId);
-        if (r != SQLITE_OK)
-        {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
-            goto Exit;
-        }
-
         eck::CRefStrA rsSql{};
         int cCol{};
 
@@ -360,11 +330,11 @@ static void AwUpdateTask(const API_CTX& Ctx) noexcept
         rsSql.PushBack(EckStrAndLen(" WHERE task_id = ?;"));
 
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
+        r = sqlite3_prepare_v3(Ctx.pSqlite,
             rsSql.Data(), rsSql.Size(), 0, &pStmt, nullptr);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
         // 绑定
@@ -391,7 +361,7 @@ static void AwUpdateTask(const API_CTX& Ctx) noexcept
         if (r == SQLITE_DONE)
             r = SQLITE_OK;
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::BadPayload;
@@ -413,15 +383,16 @@ static void AwGetTaskList(const API_CTX& Ctx) noexcept
     int r{};
     PCSTR pszErrMsg{};
 
-    std::vector<QUERY_KV> vKv{};
-    ApiParseQueryString(Ctx, vKv);
     int cEntry{}, nPage{}, iProjId{ DbIdInvalid };
-    for (const auto& e : vKv)
+    std::string_view svCursor{};
+    for (const auto& e : ApiGetQuery(Ctx))
     {
         if (TKK_API_HIT_QUERY("count"))
             ApiParseInt(e.V, cEntry);
         else if (TKK_API_HIT_QUERY("page"))
             ApiParseInt(e.V, nPage);
+        else if (TKK_API_HIT_QUERY("cursor"))
+            svCursor = e.V;
         else if (TKK_API_HIT_QUERY("project_id"))
             ApiParseInt(e.V, iProjId);
     }
@@ -429,66 +400,91 @@ static void AwGetTaskList(const API_CTX& Ctx) noexcept
     if (cEntry <= 0 || cEntry > MaxQueryCount)
         cEntry = MaxQueryCount;
 
-    Json::CMutDoc j{};
-    const auto Arr = j.NewArray();
+    auto& rbJson = ApiGetJsonBuffer();
+    CJsonWriter w{ rbJson };
+    w.BeginObject().Key("data").BeginArray();
+
+    // 带游标时从游标处继续，忽略page
+    API_CURSOR Cursor{ LLONG_MIN, 0 };
+    int cRow{};
+    if (!svCursor.empty())
+    {
+        if (!ApiParseCursor(svCursor, Cursor))
+        {
+            rApi = ApiResult::BadPayload;
+            goto Exit;
+        }
+        nPage = 0;
+    }
 
-    constexpr char Sql[]{ R"(
+    // 没有显式记录的任务继承项目的权限，只需判断一次
+    const auto iUserId = CkDbGetCurrentPseudoUser(Ctx);
+    const auto bInherit = AclDbCheckAccess(Ctx, iUserId,
+        iProjId, DbAccess::ReadContent, r);
+    if (r != SQLITE_OK)
+    {
+        pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
+        goto Exit;
+    }
+
+    constexpr auto& Sql = TKK_DB_SQL(R"(
 SELECT
     t.task_id, t.task_name, t.status, t.priority,
     t.description, t.create_at, t.update_at,
     t.expire_at, t.assignee_id, t.creator_id
 FROM Task AS t
-JOIN Acl AS a
-ON a.entity_id = t.project_id
+LEFT JOIN Acl AS a
+ON a.user_id = ?2 AND a.entity_id = t.task_id
 WHERE
-    t.project_id = ? AND
-    a.user_id = ? AND
-    (a.access & ?) != 0
+    t.project_id = ?1 AND
+    CASE WHEN a.access IS NULL THEN ?3 ELSE (a.access & ?4) != 0 END AND
+    t.task_id > ?7
 ORDER BY t.task_id ASC
-LIMIT ? OFFSET ?;
-)" };
+LIMIT ?5 OFFSET ?6;
+)");
     sqlite3_stmt* pStmt;
-    r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-        EckStrAndLen(Sql), 0, &pStmt, nullptr);
+    r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
     if (r != SQLITE_OK)
     {
-        pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+        pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
         goto Exit;
     }
     sqlite3_bind_int(pStmt, 1, iProjId);
-    sqlite3_bind_int(pStmt, 2, CkDbGetCurrentPseudoUser(Ctx));
-    sqlite3_bind_int(pStmt, 3, int(DbAccess::ReadContent | DbAccess::FullControl));
-    sqlite3_bind_int(pStmt, 4, cEntry);
-    sqlite3_bind_int(pStmt, 5, nPage * cEntry);
+    sqlite3_bind_int(pStmt, 2, iUserId);
+    sqlite3_bind_int(pStmt, 3, bInherit);
+    sqlite3_bind_int(pStmt, 4, int(DbAccess::ReadContent | DbAccess::FullControl));
+    sqlite3_bind_int(pStmt, 5, cEntry);
+    sqlite3_bind_int(pStmt, 6, nPage * cEntry);
+    sqlite3_bind_int64(pStmt, 7, Cursor.k1);
     while ((r = sqlite3_step(pStmt)) == SQLITE_ROW)
     {
-        const auto Obj = j.NewObject();
-        Obj = {
-            "task_id", sqlite3_column_int(pStmt, 0),
-            "task_name", SuColumnStringView(pStmt, 1),
-            "status", sqlite3_column_int(pStmt, 2),
-            "priority", sqlite3_column_int(pStmt, 3),
-            "description", SuColumnStringView(pStmt, 4),
-            "create_at", sqlite3_column_int64(pStmt, 5),
-            "update_at", sqlite3_column_int64(pStmt, 6),
-            "expire_at", sqlite3_column_int64(pStmt, 7),
-            "assignee_id", sqlite3_column_int(pStmt, 8),
-            "creator_id", sqlite3_column_int(pStmt, 9),
-        };
-        Arr.ArrPushBack(Obj);
+        Cursor = { sqlite3_column_int64(pStmt, 0) };
+        ++cRow;
+        w.BeginObject()
+            .Member("task_id", sqlite3_column_int(pStmt, 0))
+            .Member("task_name", SuColumnStringView(pStmt, 1))
+            .Member("status", sqlite3_column_int(pStmt, 2))
+            .Member("priority", sqlite3_column_int(pStmt, 3))
+            .Member("description", SuColumnStringView(pStmt, 4))
+            .Member("create_at", sqlite3_column_int64(pStmt, 5))
+            .Member("update_at", sqlite3_column_int64(pStmt, 6))
+            .Member("expire_at", sqlite3_column_int64(pStmt, 7))
+            .Member("assignee_id", sqlite3_column_int(pStmt, 8))
+            .Member("creator_id", sqlite3_column_int(pStmt, 9))
+            .EndObject();
     }
-    sqlite3_finalize(pStmt);
+    DbFinalize(pStmt);
     if (r == SQLITE_DONE)
         r = SQLITE_OK;
     else
-        pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+        pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
 Exit:
-    j = {
-        "r", r == SQLITE_OK ? rApi : ApiResult::Database,
-        "r2", r,
-        "err_msg", pszErrMsg,
-        "data", Arr
-    };
-    ApiSendResponseJson(Ctx, j);
+    w.EndArray();
+    ApiWriteNextCursor(w, cRow == cEntry, Cursor);
+    w.Member("r", r == SQLITE_OK ? rApi : ApiResult::Database)
+        .Member("r2", r)
+        .Member("err_msg", pszErrMsg)
+        .EndObject();
+    ApiSendResponseJson(Ctx, rbJson);
 }
 TKK_API_DEF_ENTRY(ApiGet_TaskList, AwGetTaskList)
\ No newline at end of file
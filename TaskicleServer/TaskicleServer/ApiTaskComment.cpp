@@ -10,21 +10,20 @@ static ApiResult QueryTaskId(const API_CTX& Ctx, int iCommId,
 {
     iTaskId = DbIdInvalid;
     sqlite3_stmt* pStmt;
-    constexpr char SqlQuery[]{ R"(
+    constexpr auto& SqlQuery = TKK_DB_SQL(R"(
 SELECT task_id FROM TaskComment WHERE comm_id = ?;
-)" };
-    rSql = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-        EckStrAndLen(SqlQuery), 0, &pStmt, nullptr);
+)");
+    rSql = DbPrepare(Ctx.pSqlite, SqlQuery, pStmt);
     if (rSql != SQLITE_OK)
         return ApiResult::Database;
     sqlite3_bind_int(pStmt, 1, iCommId);
     if (sqlite3_step(pStmt) != SQLITE_ROW)
     {
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
         return ApiResult::NotFound;
     }
     iTaskId = sqlite3_column_int(pStmt, 0);
-    sqlite3_finalize(pStmt);
+    DbFinalize(pStmt);
     return ApiResult::Ok;
 }
 
@@ -58,16 +57,15 @@ static void AwInsertTaskComment(const API_CTX& Ctx) noexcept
             goto Exit;
         }
 
-        constexpr char Sql[]{ R"(
+        constexpr auto& Sql = TKK_DB_SQL(R"(
 INSERT INTO TaskComment(task_id, user_id, content)
 VALUES (?, ?, ?);
-)" };
+)");
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-            EckStrAndLen(Sql), 0, &pStmt, nullptr);
+        r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
 
@@ -76,11 +74,11 @@ VALUES (?, ?, ?);
         SuBindJsonStringValue(pStmt, 3, ValContent);
 
         r = sqlite3_step(pStmt);
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
         if (r == SQLITE_DONE)
             r = SQLITE_OK;
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::BadPayload;
@@ -122,7 +120,7 @@ static void AwDeleteTaskComment(const API_CTX& Ctx) noexcept
         if (rApi != ApiResult::Ok)
         {
             if (r != SQLITE_OK)
-                pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+                pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
 
@@ -134,21 +132,20 @@ static void AwDeleteTaskComment(const API_CTX& Ctx) noexcept
         }
 
         sqlite3_stmt* pStmt;
-        constexpr char Sql[]{ R"(DELETE FROM TaskComment WHERE comm_id = ?)" };
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-            EckStrAndLen(Sql), 0, &pStmt, nullptr);
+        constexpr auto& Sql = TKK_DB_SQL(R"(DELETE FROM TaskComment WHERE comm_id = ?)");
+        r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
         sqlite3_bind_int(pStmt, 1, iCommId);
         r = sqlite3_step(pStmt);
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
         if (r == SQLITE_DONE)
             r = SQLITE_OK;
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::BadPayload;
@@ -191,7 +188,7 @@ static void AwUpdateTaskComment(const API_CTX& Ctx) noexcept
         if (rApi != ApiResult::Ok)
         {
             if (r != SQLITE_OK)
-                pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+                pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
 
@@ -202,16 +199,14 @@ static void AwUpdateTaskComment(const API_CTX& Ctx) noexcept
             goto Exit;
         }
 
-        constexpr char Sql[]{ R"(
+        constexpr auto& Sql = TKK_DB_SQL(R"(
 UPDATE TaskComment
-SET modified = 1, content = ? WHERE comm_id = ?)"
-        };
+SET modified = 1, content = ? WHERE comm_id = ?)");
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-            EckStrAndLen(Sql), 0, &pStmt, nullptr);
+        r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
 
@@ -219,11 +214,11 @@ SET modified = 1, content = ? WHERE comm_id = ?)"
         sqlite3_bind_int(pStmt, 2, iCommId);
 
         r = sqlite3_step(pStmt);
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
         if (r == SQLITE_DONE)
             r = SQLITE_OK;
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::BadPayload;
@@ -245,15 +240,16 @@ static void AwGetTaskCommentList(const API_CTX& Ctx) noexcept
     int r{};
     PCSTR pszErrMsg{};
 
-    std::vector<QUERY_KV> vKv{};
-    ApiParseQueryString(Ctx, vKv);
     int cEntry{}, nPage{}, iTaskId{ DbIdInvalid };
-    for (const auto& e : vKv)
+    std::string_view svCursor{};
+    for (const auto& e : ApiGetQuery(Ctx))
     {
         if (TKK_API_HIT_QUERY("count"))
             ApiParseInt(e.V, cEntry);
         else if (TKK_API_HIT_QUERY("page"))
             ApiParseInt(e.V, nPage);
+        else if (TKK_API_HIT_QUERY("cursor"))
+            svCursor = e.V;
         else if (TKK_API_HIT_QUERY("task_id"))
             ApiParseInt(e.V, iTaskId);
     }
@@ -261,8 +257,22 @@ static void AwGetTaskCommentList(const API_CTX& Ctx) noexcept
     if (cEntry <= 0 || cEntry > MaxQueryCount)
         cEntry = MaxQueryCount;
 
-    Json::CMutDoc j{};
-    const auto Arr = j.NewArray();
+    auto& rbJson = ApiGetJsonBuffer();
+    CJsonWriter w{ rbJson };
+    w.BeginObject().Key("data").BeginArray();
+
+    // 带游标时从游标处继续，忽略page
+    API_CURSOR Cursor{ LLONG_MAX, LLONG_MAX };
+    int cRow{};
+    if (!svCursor.empty())
+    {
+        if (!ApiParseCursor(svCursor, Cursor))
+        {
+            rApi = ApiResult::BadPayload;
+            goto Exit;
+        }
+        nPage = 0;
+    }
 
     if (iTaskId != DbIdInvalid)
     {
@@ -273,54 +283,57 @@ static void AwGetTaskCommentList(const API_CTX& Ctx) noexcept
             goto Exit;
         }
 
-        constexpr char Sql[]{ R"(
+        constexpr auto& Sql = TKK_DB_SQL(R"(
 SELECT t.comm_id, t.user_id, t.content, t.create_at, t.modified, u.user_name
 FROM TaskComment AS t
 JOIN User AS u
 ON t.user_id = u.user_id
-WHERE t.task_id = ?
-ORDER BY t.create_at DESC
-LIMIT ? OFFSET ?;
-)" };
+WHERE
+    t.task_id = ?1 AND
+    (t.create_at, t.comm_id) < (?4, ?5)
+ORDER BY t.create_at DESC, t.comm_id DESC
+LIMIT ?2 OFFSET ?3;
+)");
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-            EckStrAndLen(Sql), 0, &pStmt, nullptr);
+        r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         if (r == SQLITE_OK)
         {
             sqlite3_bind_int(pStmt, 1, iTaskId);
             sqlite3_bind_int(pStmt, 2, cEntry);
             sqlite3_bind_int(pStmt, 3, nPage * cEntry);
+            sqlite3_bind_int64(pStmt, 4, Cursor.k1);
+            sqlite3_bind_int64(pStmt, 5, Cursor.k2);
             while ((r = sqlite3_step(pStmt)) == SQLITE_ROW)
             {
-                const auto Obj = j.NewObject();
-                Obj = {
-                    "comm_id", sqlite3_column_int(pStmt, 0),
-                    "user_id", sqlite3_column_int(pStmt, 1),
-                    "content", SuColumnStringView(pStmt, 2),
-                    "create_at", sqlite3_column_int64(pStmt, 3),
-                    "modified", !!sqlite3_column_int(pStmt, 4),
-                    "user_name", SuColumnStringView(pStmt, 5),
-                };
-                Arr.ArrPushBack(Obj);
+                Cursor = { sqlite3_column_int64(pStmt, 3), sqlite3_column_int64(pStmt, 0) };
+                ++cRow;
+                w.BeginObject()
+                    .Member("comm_id", sqlite3_column_int(pStmt, 0))
+                    .Member("user_id", sqlite3_column_int(pStmt, 1))
+                    .Member("content", SuColumnStringView(pStmt, 2))
+                    .Member("create_at", sqlite3_column_int64(pStmt, 3))
+                    .Member("modified", !!sqlite3_column_int(pStmt, 4))
+                    .Member("user_name", SuColumnStringView(pStmt, 5))
+                    .EndObject();
             }
-            sqlite3_finalize(pStmt);
+            DbFinalize(pStmt);
             if (r == SQLITE_DONE)
                 r = SQLITE_OK;
             else
-                pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+                pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
         }
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::RequiredFieldMissing;
 Exit:
-    j = {
-        "r", r == SQLITE_OK ? rApi : ApiResult::Database,
-        "r2", r,
-        "err_msg", pszErrMsg,
-        "data", Arr
-    };
-    ApiSendResponseJson(Ctx, j);
+    w.EndArray();
+    ApiWriteNextCursor(w, cRow == cEntry, Cursor);
+    w.Member("r", r == SQLITE_OK ? rApi : ApiResult::Database)
+        .Member("r2", r)
+        .Member("err_msg", pszErrMsg)
+        .EndObject();
+    ApiSendResponseJson(Ctx, rbJson);
 }
 TKK_API_DEF_ENTRY(ApiGet_TaskCommentList, AwGetTaskCommentList)
\ No newline at end of file
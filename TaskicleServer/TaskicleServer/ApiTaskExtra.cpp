@@ -12,15 +12,16 @@ static void AwGetTaskLogList(const API_CTX& Ctx) noexcept
     int r{};
     PCSTR pszErrMsg{};
 
-    std::vector<QUERY_KV> vKv{};
-    ApiParseQueryString(Ctx, vKv);
     int cEntry{}, nPage{}, iTaskId{ DbIdInvalid };
-    for (const auto& e : vKv)
+    std::string_view svCursor{};
+    for (const auto& e : ApiGetQuery(Ctx))
     {
         if (TKK_API_HIT_QUERY("count"))
             ApiParseInt(e.V, cEntry);
         else if (TKK_API_HIT_QUERY("page"))
             ApiParseInt(e.V, nPage);
+        else if (TKK_API_HIT_QUERY("cursor"))
+            svCursor = e.V;
         else if (TKK_API_HIT_QUERY("task_id"))
             ApiParseInt(e.V, iTaskId);
     }
@@ -28,66 +29,83 @@ static void AwGetTaskLogList(const API_CTX& Ctx) noexcept
     if (cEntry <= 0 || cEntry > MaxQueryCount)
         cEntry = MaxQueryCount;
 
-    Json::CMutDoc j{};
-    const auto Arr = j.NewArray();
+    auto& rbJson = ApiGetJsonBuffer();
+    CJsonWriter w{ rbJson };
+    w.BeginObject().Key("data").BeginArray();
+
+    // 带游标时从游标处继续，忽略page
+    API_CURSOR Cursor{ LLONG_MAX, LLONG_MAX };
+    int cRow{};
+    if (!svCursor.empty())
+    {
+        if (!ApiParseCursor(svCursor, Cursor))
+        {
+            rApi = ApiResult::BadPayload;
+            goto Exit;
+        }
+        nPage = 0;
+    }
 
     if (iTaskId != DbIdInvalid)
     {
-        constexpr char Sql[]{ R"(
-SELECT t.field_name, t.old_value, t.new_value, t.change_at, t.user_id, u.user_name
+        if (!AclDbCheckAccess(Ctx, CkDbGetCurrentPseudoUser(Ctx),
+            iTaskId, DbAccess::ReadChange, r))
+        {
+            rApi = ApiResult::AccessDenied;
+            goto Exit;
+        }
+
+        constexpr auto& Sql = TKK_DB_SQL(R"(
+SELECT t.field_name, t.old_value, t.new_value, t.change_at, t.user_id, u.user_name, t.id
 FROM TaskLog AS t
-JOIN Acl AS a ON a.entity_id = t.task_id
 LEFT JOIN User AS u ON u.user_id = t.user_id
 WHERE
-    t.task_id = ? AND
-    a.user_id = ? AND
-    (a.access & ?) != 0
-ORDER BY t.change_at DESC
-LIMIT ? OFFSET ?;
-)" };
+    t.task_id = ?1 AND
+    (t.change_at, t.id) < (?4, ?5)
+ORDER BY t.change_at DESC, t.id DESC
+LIMIT ?2 OFFSET ?3;
+)");
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-            EckStrAndLen(Sql), 0, &pStmt, nullptr);
+        r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
 
         sqlite3_bind_int(pStmt, 1, iTaskId);
-        sqlite3_bind_int(pStmt, 2, CkDbGetCurrentPseudoUser(Ctx));
-        sqlite3_bind_int(pStmt, 3, int(DbAccess::ReadChange | DbAccess::FullControl));
-        sqlite3_bind_int(pStmt, 4, cEntry);
-        sqlite3_bind_int(pStmt, 5, nPage * cEntry);
+        sqlite3_bind_int(pStmt, 2, cEntry);
+        sqlite3_bind_int(pStmt, 3, nPage * cEntry);
+        sqlite3_bind_int64(pStmt, 4, Cursor.k1);
+        sqlite3_bind_int64(pStmt, 5, Cursor.k2);
         while ((r = sqlite3_step(pStmt)) == SQLITE_ROW)
         {
-            const auto Obj = j.NewObject();
-            Obj = {
-                "field_name", SuColumnStringView(pStmt, 0),
-                "old_value", SuColumnStringView(pStmt, 1),
-                "new_value", SuColumnStringView(pStmt, 2),
-                "change_at", sqlite3_column_int64(pStmt, 3),
-                "user_id", sqlite3_column_int(pStmt, 4),
-                "user_name", SuColumnStringView(pStmt, 5)
-            };
-            Arr.ArrPushBack(Obj);
+            Cursor = { sqlite3_column_int64(pStmt, 3), sqlite3_column_int64(pStmt, 6) };
+            ++cRow;
+            w.BeginObject()
+                .Member("field_name", SuColumnStringView(pStmt, 0))
+                .Member("old_value", SuColumnStringView(pStmt, 1))
+                .Member("new_value", SuColumnStringView(pStmt, 2))
+                .Member("change_at", sqlite3_column_int64(pStmt, 3))
+                .Member("user_id", sqlite3_column_int(pStmt, 4))
+                .EndObject();
         }
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
         if (r == SQLITE_DONE)
             r = SQLITE_OK;
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::RequiredFieldMissing;
 Exit:
-    j = {
-        "r", r == SQLITE_OK ? rApi : ApiResult::Database,
-        "r2", r,
-        "err_msg", pszErrMsg,
-        "data", Arr
-    };
-    ApiSendResponseJson(Ctx, j);
+    w.EndArray();
+    ApiWriteNextCursor(w, cRow == cEntry, Cursor);
+    w.Member("r", r == SQLITE_OK ? rApi : ApiResult::Database)
+        .Member("r2", r)
+        .Member("err_msg", pszErrMsg)
+        .EndObject();
+    ApiSendResponseJson(Ctx, rbJson);
 }
 TKK_API_DEF_ENTRY(ApiGet_TaskLogList, AwGetTaskLogList)
 
@@ -151,11 +169,11 @@ WHERE EXISTS (SELECT 1 FROM
         }
 
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
+        r = sqlite3_prepare_v3(Ctx.pSqlite,
             rsSql.Data(), rsSql.Size(), 0, &pStmt, nullptr);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
         sqlite3_bind_int(pStmt, 1, ValId.GetInt());
@@ -169,11 +187,11 @@ WHERE EXISTS (SELECT 1 FROM
         if (r == SQLITE_DONE)
         {
             r = SQLITE_OK;
-            if (!sqlite3_changes(Ctx.pExtra->pSqlite))
+            if (!sqlite3_changes(Ctx.pSqlite))
                 rApi = ApiResult::NoEffect;
         }
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::BadPayload;
@@ -217,26 +235,25 @@ static void AwDeleteTaskRelation(const API_CTX& Ctx) noexcept
             goto Exit;
         }
 
-        constexpr char Sql[]{ R"(
+        constexpr auto& Sql = TKK_DB_SQL(R"(
 DELETE FROM TaskRelation
 WHERE task_id = ? AND relation_id = ?;
-)" };
+)");
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-            EckStrAndLen(Sql), 0, &pStmt, nullptr);
+        r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
         sqlite3_bind_int(pStmt, 1, ValTaskId.GetInt());
         sqlite3_bind_int(pStmt, 2, ValRelId.GetInt());
         r = sqlite3_step(pStmt);
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
         if (r == SQLITE_DONE)
             r = SQLITE_OK;
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::BadPayload;
@@ -258,10 +275,8 @@ static void AwGetTaskRelationList(const API_CTX& Ctx) noexcept
     int r{};
     PCSTR pszErrMsg{};
 
-    std::vector<QUERY_KV> vKv{};
-    ApiParseQueryString(Ctx, vKv);
     int cEntry{}, nPage{}, iTaskId{ DbIdInvalid };
-    for (const auto& e : vKv)
+    for (const auto& e : ApiGetQuery(Ctx))
     {
         if (TKK_API_HIT_QUERY("task_id"))
             ApiParseInt(e.V, iTaskId);
@@ -270,8 +285,9 @@ static void AwGetTaskRelationList(const API_CTX& Ctx) noexcept
     if (cEntry <= 0 || cEntry > MaxQueryCount)
         cEntry = MaxQueryCount;
 
-    Json::CMutDoc j{};
-    const auto Arr = j.NewArray();
+    auto& rbJson = ApiGetJsonBuffer();
+    CJsonWriter w{ rbJson };
+    w.BeginObject().Key("data").BeginArray();
 
     if (iTaskId != DbIdInvalid)
     {
@@ -282,47 +298,43 @@ static void AwGetTaskRelationList(const API_CTX& Ctx) noexcept
             goto Exit;
         }
 
-        constexpr char Sql[]{ R"(
+        constexpr auto& Sql = TKK_DB_SQL(R"(
 SELECT r.relation_id, r.relation_type, COALESCE(t.task_name, p.page_name)
 FROM TaskRelation AS r
 LEFT JOIN Task AS t ON (r.relation_type = 1 AND t.task_id = r.relation_id)
 LEFT JOIN Page AS p ON (r.relation_type = 2 AND p.page_id = r.relation_id)
 WHERE r.task_id = ?;
-)" };
+)");
         sqlite3_stmt* pStmt;
-        r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-            EckStrAndLen(Sql), 0, &pStmt, nullptr);
+        r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
         if (r != SQLITE_OK)
         {
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
         sqlite3_bind_int(pStmt, 1, iTaskId);
         while ((r = sqlite3_step(pStmt)) == SQLITE_ROW)
         {
-            const auto Obj = j.NewObject();
-            Obj = {
-                "relation_id", sqlite3_column_int(pStmt, 0),
-                "relation_type", sqlite3_column_int(pStmt, 1),
-                "name", SuColumnStringView(pStmt, 2),
-            };
-            Arr.ArrPushBack(Obj);
+            w.BeginObject()
+                .Member("relation_id", sqlite3_column_int(pStmt, 0))
+                .Member("relation_type", sqlite3_column_int(pStmt, 1))
+                .Member("name", SuColumnStringView(pStmt, 2))
+                .EndObject();
         }
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
         if (r == SQLITE_DONE)
             r = SQLITE_OK;
         else
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
     }
     else
         rApi = ApiResult::RequiredFieldMissing;
 Exit:
-    j = {
-        "r", r == SQLITE_OK ? rApi : ApiResult::Database,
-        "r2", r,
-        "err_msg", pszErrMsg,
-        "data", Arr
-    };
-    ApiSendResponseJson(Ctx, j);
+    w.EndArray()
+        .Member("r", r == SQLITE_OK ? rApi : ApiResult::Database)
+        .Member("r2", r)
+        .Member("err_msg", pszErrMsg)
+        .EndObject();
+    ApiSendResponseJson(Ctx, rbJson);
 }
 TKK_API_DEF_ENTRY(ApiGet_TaskRelationList, AwGetTaskRelationList)
\ No newline at end of file
@@ -4,14 +4,7 @@
 #include "Database.h"
 #include "SqliteUtils.h"
 #include "AccessCheck.h"
-
-struct CK_SID
-{
-    char Hdr[4];
-    UINT Random[6];
-    ULONGLONG TimeStamp;
-};
-constexpr static size_t CkSidStrLen = 2 * sizeof(CK_SID);
+#include "SessionCache.h"
 
 struct UM_PW_HASH
 {
@@ -42,70 +35,103 @@ static void CkGenerateSessionId(const API_CTX& Ctx,
     eck::ToStringUpper(&Sid, sizeof(Sid), pszSid);
 }
 
-// 将覆盖先前的会话ID，返回sqlite错误码
+// 将覆盖先前的会话ID，同时写入会话缓存，返回sqlite错误码
 static int CkDbStoreSessionId(const API_CTX& Ctx,
     _In_reads_(CkSidStrLen) PCCH pszSid,
     int iUserId,
+    DbUserRole eRole,
     UINT cExpiredSecond) noexcept
 {
     sqlite3_stmt* pStmtCleanup, * pStmtInsert;
     int r;
+    const CK_SESSION Session
+    {
+        .iUserId = iUserId,
+        .eRole = eRole,
+        .tExpire = eck::GetUnixTimestampMs() + cExpiredSecond * 1000ull,
+    };
 
-    constexpr char SqlCleanup[]{ R"(DELETE FROM UserSession WHERE user_id = ?;)" };
-    constexpr char SqlInsert[]{ R"(
+    constexpr auto& SqlCleanup = TKK_DB_SQL(R"(DELETE FROM UserSession WHERE user_id = ?;)");
+    constexpr auto& SqlInsert = TKK_DB_SQL(R"(
 INSERT INTO UserSession (user_id, session_id, expire_at)
 VALUES (?,?,?);
-)" };
+)");
 
-    r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-        EckStrAndLen(SqlCleanup), 0, &pStmtCleanup, nullptr);
+    r = DbPrepare(Ctx.pSqlite, SqlCleanup, pStmtCleanup);
     if (r != SQLITE_OK)
         return r;
     sqlite3_bind_int(pStmtCleanup, 1, iUserId);
 
-    r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-        EckStrAndLen(SqlInsert), 0, &pStmtInsert, nullptr);
+    r = DbPrepare(Ctx.pSqlite, SqlInsert, pStmtInsert);
     if (r != SQLITE_OK)
     {
-        sqlite3_finalize(pStmtCleanup);
+        DbFinalize(pStmtCleanup);
         return r;
     }
     sqlite3_bind_int(pStmtInsert, 1, iUserId);
     sqlite3_bind_text(pStmtInsert, 2, pszSid, (int)CkSidStrLen, nullptr);
-    sqlite3_bind_int64(pStmtInsert, 3,
-        eck::GetUnixTimestampMs() + cExpiredSecond * 1000ull);
+    sqlite3_bind_int64(pStmtInsert, 3, (sqlite3_int64)Session.tExpire);
 
-    CSqliteTransaction Tx{ Ctx.pExtra->pSqlite };
+    // 不在事务期间持有用户锁，缓存的写入顺序由代数保证
+    ULONGLONG nGen{};
+    CSqliteTransaction Tx{ Ctx.pSqlite };
     r = sqlite3_step(pStmtCleanup);
-    sqlite3_finalize(pStmtCleanup);
+    DbFinalize(pStmtCleanup);
     if (r == SQLITE_DONE)
     {
         r = sqlite3_step(pStmtInsert);
         if (r == SQLITE_DONE)
+        {
+            // 已持有写锁，其他连接的登录不能在此期间提交
+            nGen = CkCacheNextGeneration();
             r = SQLITE_OK;
+        }
     }
-    sqlite3_finalize(pStmtInsert);
+    DbFinalize(pStmtInsert);
     if (r == SQLITE_OK)
-        Tx.Commit();
+        r = Tx.Commit();
+    if (r == SQLITE_OK)
+        CkCacheStore(pszSid, Session, nGen);
+    return r;
+}
+
+// 清理数据库中已过期的会话，返回sqlite错误码
+static int CkDbCleanupExpiredSession(const API_CTX& Ctx, ULONGLONG tNow) noexcept
+{
+    constexpr auto& Sql = TKK_DB_SQL(R"(DELETE FROM UserSession WHERE expire_at <= ?;)");
+    sqlite3_stmt* pStmt;
+    int r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
+    if (r != SQLITE_OK)
+        return r;
+    sqlite3_bind_int64(pStmt, 1, (sqlite3_int64)tNow);
+    r = sqlite3_step(pStmt);
+    DbFinalize(pStmt);
+    if (r == SQLITE_DONE)
+        r = SQLITE_OK;
+    else
+        LOGE << "Sqlite error: " << r << "(" << sqlite3_errmsg(Ctx.pSqlite) << ")";
     return r;
 }
 
-// 返回sqlite错误码
+// 缓存未命中时查询数据库，找到的会话将载入缓存，返回sqlite错误码
 static int CkDbQuerySessionId(const API_CTX& Ctx,
     _In_reads_(CkSidStrLen) PCCH pszSid,
-    _Out_ int& iUserId) noexcept
+    ULONGLONG tNow,
+    _Out_ CK_SESSION& Session) noexcept
 {
-    iUserId = DbIdInvalid;
+    Session.iUserId = DbIdInvalid;
     sqlite3_stmt* pStmt;
     int r;
 
-    constexpr char Sql[]{ R"(
-SELECT user_id, expire_at FROM UserSession
-WHERE session_id = ?;
-)" };
+    constexpr auto& Sql = TKK_DB_SQL(R"(
+SELECT s.user_id, s.expire_at, u.role
+FROM UserSession AS s
+JOIN User AS u
+ON u.user_id = s.user_id
+WHERE s.session_id = ?;
+)");
 
-    r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-        EckStrAndLen(Sql), 0, &pStmt, nullptr);
+    r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
     if (r != SQLITE_OK)
         return r;
     sqlite3_bind_text(pStmt, 1, pszSid, (int)CkSidStrLen, nullptr);
@@ -113,77 +139,92 @@ WHERE session_id = ?;
     if (r == SQLITE_ROW)
     {
         r = SQLITE_OK;
-        iUserId = sqlite3_column_int(pStmt, 0);
+        // 过期的会话由时间轮推进时批量删除
         const auto tExpire = (ULONGLONG)sqlite3_column_int64(pStmt, 1);
-        if (tExpire < eck::GetUnixTimestampMs())
+        if (tExpire > tNow)
         {
-            iUserId = DbIdInvalid;
-            constexpr char SqlDelete[]{ R"(
-DELETE FROM UserSession WHERE session_id = ?;
-)" };
-            sqlite3_stmt* pStmtDelete;
-            r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-                EckStrAndLen(SqlDelete), 0, &pStmtDelete, nullptr);
-            if (r == SQLITE_OK)
-            {
-                sqlite3_bind_text(pStmtDelete, 1, pszSid, (int)CkSidStrLen, nullptr);
-                sqlite3_step(pStmtDelete);
-            }
+            Session.iUserId = sqlite3_column_int(pStmt, 0);
+            Session.eRole = (DbUserRole)sqlite3_column_int(pStmt, 2);
+            Session.tExpire = tExpire;
         }
     }
-    sqlite3_finalize(pStmt);
+    else if (r == SQLITE_DONE)
+        r = SQLITE_OK;
+    DbFinalize(pStmt);
+    if (Session.iUserId != DbIdInvalid)
+        CkCachePopulate(pszSid, Session);
     return r;
 }
 
+// 取当前请求的会话，失败返回FALSE
+static BOOL CkDbGetCurrentSession(const API_CTX& Ctx, _Out_ CK_SESSION& Session) noexcept
+{
+    if (Ctx.Req.svSid.empty())
+        return FALSE;
+    const auto pszSid = Ctx.Req.svSid.data();
+
+    const auto tNow = eck::GetUnixTimestampMs();
+    if (CkCacheAdvance(tNow))
+        CkDbCleanupExpiredSession(Ctx, tNow);
+    if (CkCacheLookup(pszSid, tNow, Session))
+        return TRUE;
+    CkDbQuerySessionId(Ctx, pszSid, tNow, Session);
+    return Session.iUserId != DbIdInvalid;
+}
+
+void CkDbResolveCurrentUser(API_CTX& Ctx) noexcept
+{
+    CK_SESSION Session;
+    if (CkDbGetCurrentSession(Ctx, Session))
+    {
+        Ctx.iUserId = Session.iUserId;
+        Ctx.iPseudoUserId = (Session.eRole == DbUserRole::Admin ?
+            DbIdUserAdmin : Session.iUserId);
+    }
+    else
+        Ctx.iUserId = Ctx.iPseudoUserId = DbIdUserGuest;
+}
+
 // 返回当前用户ID
 int CkDbGetCurrentUser(const API_CTX& Ctx) noexcept
 {
-    PCSTR pszCookie;
-    if (!Ctx.pSender->GetHeader(Ctx.dwConnId, "Cookie", &pszCookie))
-        return DbIdUserGuest;
-    auto pBegin = eck::TcsStrI(pszCookie, "sid=");
-    if (!pBegin)
-        return DbIdUserGuest;
-    pBegin += 4;
-    auto pEnd = eck::TcsChar(pBegin, ';');
-    if (!pEnd)
-        pEnd = pBegin + eck::TcsLen(pBegin);
-    const auto cchSid = pEnd - pBegin;
-    if (cchSid != CkSidStrLen)
-        return DbIdUserGuest;
-    int iUserId;
-    CkDbQuerySessionId(Ctx, pBegin, iUserId);
-    if (iUserId != DbIdInvalid)
-        return iUserId;
+    if ((Ctx.eRes & ApiRes::Auth) != ApiRes::None)
+        return Ctx.iUserId;
+    CK_SESSION Session;
+    if (CkDbGetCurrentSession(Ctx, Session))
+        return Session.iUserId;
     return DbIdUserGuest;
 }
 
 int CkDbGetCurrentPseudoUser(const API_CTX& Ctx) noexcept
 {
-    const auto id = CkDbGetCurrentUser(Ctx);
-    if (UmIsAdministrator(Ctx, id))
+    if ((Ctx.eRes & ApiRes::Auth) != ApiRes::None)
+        return Ctx.iPseudoUserId;
+    CK_SESSION Session;
+    if (!CkDbGetCurrentSession(Ctx, Session))
+        return DbIdUserGuest;
+    if (Session.eRole == DbUserRole::Admin)
         return DbIdUserAdmin;
-    return id;
+    return Session.iUserId;
 }
 
 BOOL UmIsAdministrator(const API_CTX& Ctx, int id) noexcept
 {
     int r;
-    constexpr char Sql[]{ R"(SELECT role FROM User WHERE user_id = ?;)" };
+    constexpr auto& Sql = TKK_DB_SQL(R"(SELECT role FROM User WHERE user_id = ?;)");
 
     sqlite3_stmt* pStmt;
-    r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-        EckStrAndLen(Sql), 0, &pStmt, nullptr);
+    r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
     if (r != SQLITE_OK)
         return FALSE;
     sqlite3_bind_int(pStmt, 1, id);
     if (sqlite3_step(pStmt) == SQLITE_ROW)
     {
         r = sqlite3_column_int(pStmt, 0);
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
         return r == (int)DbUserRole::Admin;
     }
-    sqlite3_finalize(pStmt);
+    DbFinalize(pStmt);
     return FALSE;
 }
 
@@ -199,11 +240,10 @@ static ApiResult UmDbQueryUser(
     eRole = DbUserRole::Normal;
     iUserId = DbIdInvalid;
 
-    constexpr char Sql[]{ R"(SELECT user_id, pw_hash, role FROM User WHERE user_name = ?;)" };
+    constexpr auto& Sql = TKK_DB_SQL(R"(SELECT user_id, pw_hash, role FROM User WHERE user_name = ?;)");
 
     sqlite3_stmt* pStmt;
-    r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-        EckStrAndLen(Sql), 0, &pStmt, nullptr);
+    r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
     if (r != SQLITE_OK)
         return ApiResult::Database;
     sqlite3_bind_text(pStmt, 1, svUserName.data(), (int)svUserName.size(), nullptr);
@@ -228,10 +268,10 @@ static ApiResult UmDbQueryUser(
 
         eRole = (DbUserRole)sqlite3_column_int(pStmt, 2);
 
-        sqlite3_finalize(pStmt);
+        DbFinalize(pStmt);
         return ApiResult::Ok;
     }
-    sqlite3_finalize(pStmt);
+    DbFinalize(pStmt);
     return ApiResult::Unknown;
 }
 
@@ -271,13 +311,12 @@ static ApiResult UmDbCreateUser(
     DbUserRole eRole,
     _Out_ int& r) noexcept
 {
-    constexpr char Sql[]{ R"(
+    constexpr auto& Sql = TKK_DB_SQL(R"(
 INSERT INTO User (user_name, pw_hash, role) VALUES (?,?,?);
-)" };
+)");
 
     sqlite3_stmt* pStmt;
-    r = sqlite3_prepare_v3(Ctx.pExtra->pSqlite,
-        EckStrAndLen(Sql), 0, &pStmt, nullptr);
+    r = DbPrepare(Ctx.pSqlite, Sql, pStmt);
     if (r != SQLITE_OK)
         return ApiResult::Database;
 
@@ -296,7 +335,7 @@ INSERT INTO User (user_name, pw_hash, role) VALUES (?,?,?);
     sqlite3_bind_int(pStmt, 3, (int)eRole);
 
     r = sqlite3_step(pStmt);
-    sqlite3_finalize(pStmt);
+    DbFinalize(pStmt);
     if (r == SQLITE_DONE)
         r = SQLITE_OK;
     else
@@ -310,10 +349,8 @@ static void AwLogin(const API_CTX& Ctx) noexcept
     UINT r{};
     PCSTR pszErrMsg{};
 
-    std::vector<QUERY_KV> vKv{};
-    ApiParseQueryString(Ctx, vKv);
     std::string_view svName, svPwd;
-    for (const auto& e : vKv)
+    for (const auto& e : ApiGetQuery(Ctx))
     {
         if (TKK_API_HIT_QUERY("user_name"))
             svName = e.V;
@@ -337,7 +374,7 @@ static void AwLogin(const API_CTX& Ctx) noexcept
         if (rSql != SQLITE_OK)
         {
             r = (UINT)rSql;
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
         UM_PW_HASH HashInput{ Hash };
@@ -354,12 +391,12 @@ static void AwLogin(const API_CTX& Ctx) noexcept
             constexpr UINT CkSessionExpireSecond = 10 * 24 * 60 * 60;// 10天
             char Sid[CkSidStrLen];
             CkGenerateSessionId(Ctx, Sid);
-            rSql = CkDbStoreSessionId(Ctx, Sid, iUserId, CkSessionExpireSecond);
+            rSql = CkDbStoreSessionId(Ctx, Sid, iUserId, eRole, CkSessionExpireSecond);
             if (rSql != SQLITE_OK)
             {
                 rApi = ApiResult::Database;
                 r = (UINT)rSql;
-                pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+                pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
                 goto Exit;
             }
             rApi = ApiResult::Ok;
@@ -441,7 +478,7 @@ static void AwRegister(const API_CTX& Ctx) noexcept
         if (rSql != SQLITE_OK)
         {
             r2 = (UINT)rSql;
-            pszErrMsg = sqlite3_errmsg(Ctx.pExtra->pSqlite);
+            pszErrMsg = sqlite3_errmsg(Ctx.pSqlite);
             goto Exit;
         }
         rApi = ApiResult::Ok;
@@ -2,50 +2,157 @@
 #include "CServer.h"
 #include "ServerApi.h"
 #include "Database.h"
+#include "StaticRes.h"
 
 constexpr static size_t MaxBodySize = 2 * 1024 * 1024;
 
-using FApiEntry = EnHttpParseResult(*)(const API_CTX&);
-const static std::unordered_map<std::string_view, FApiEntry> ApiMap
-{
-    { "/index.html"sv,               ApiGet_Index               },
-    { "/article"sv,                  ApiGet_Index               },
-    { "/task"sv,                     ApiGet_Index               },
-    { "/api/proj_insert"sv,          ApiPost_InsertProject      },
-    { "/api/proj_delete"sv,          ApiPost_DeleteProject      },
-    { "/api/proj_update"sv,          ApiPost_UpdateProject      },
-    { "/api/proj_list"sv,            ApiGet_ProjectList         },
-    { "/api/task_insert"sv,          ApiPost_InsertTask         },
-    { "/api/task_delete"sv,          ApiPost_DeleteTask         },
-    { "/api/task_update"sv,          ApiPost_UpdateTask         },
-    { "/api/task_list"sv,            ApiGet_TaskList            },
-    { "/api/task_comm_insert"sv,     ApiPost_InsertTaskComment  },
-    { "/api/task_comm_delete"sv,     ApiPost_DeleteTaskComment  },
-    { "/api/task_comm_update"sv,     ApiPost_UpdateTaskComment  },
-    { "/api/task_comm_list"sv,       ApiGet_TaskCommentList     },
-    { "/api/task_log"sv,             ApiGet_TaskLogList         },
-    { "/api/task_relation_insert"sv, ApiPost_InsertTaskRelation },
-    { "/api/task_relation_delete"sv, ApiPost_DeleteTaskRelation },
-    { "/api/task_relation"sv,        ApiGet_TaskRelationList    },
-    { "/api/page_group_insert"sv,    ApiPost_InsertPageGroup    },
-    { "/api/page_group_delete"sv,    ApiPost_DeletePageGroup    },
-    { "/api/page_group_update"sv,    ApiPost_UpdatePageGroup    },
-    { "/api/page_group_list"sv,      ApiGet_PageGroupList       },
-    { "/api/page_insert"sv,          ApiPost_InsertPage         },
-    { "/api/page_delete"sv,          ApiPost_DeletePage         },
-    { "/api/page_update"sv,          ApiPost_UpdatePage         },
-    { "/api/page_list"sv,            ApiGet_PageList            },
-    { "/api/page_save"sv,            ApiPost_PageSave           },
-    { "/api/page_load"sv,            ApiGet_PageLoad            },
-    { "/api/page_version_list"sv,    ApiGet_PageVersionList     },
-    { "/api/page_version_content"sv, ApiGet_PageVersionContent  },
-    { "/api/login"sv,                ApiGet_Login               },
-    { "/api/register"sv,             ApiPost_Register           },
-    { "/api/search"sv,               ApiGet_SearchEntity        },
-    { "/api/acl"sv,                  ApiGet_Acl                 },
-    { "/api/modify_acl"sv,           ApiPost_ModifyAccess       },
-    { "/api/modify_acl_user"sv,      ApiPost_ModifyAccessUser   },
+// 在线程池中执行
+using FApiEntry = void(*)(API_CTX&);
+enum class ApiMethod : BYTE
+{
+    Any,
+    Get,
+    Post,
+};
+enum class ApiKind : BYTE
+{
+    Static,     // 静态资源，缓存命中时可在I/O线程直接响应
+    Blocking,   // 访问数据库，始终在线程池中处理
+};
+struct API_ROUTE
+{
+    std::string_view svPath;// 小写
+    FApiEntry pfnEntry;
+    ApiMethod eMethod;
+    ApiRes eRes;// 调度时只取得声明的资源
+    ApiKind eKind;
+    std::wstring_view svResPath{};// 仅Static，缓存命中时直接发送的资源
+};
+constexpr static auto ApiResDbAuth = ApiRes::Db | ApiRes::Auth;
+constexpr static auto ApiResDbPvAuth = ApiRes::Db | ApiRes::PvDb | ApiRes::Auth;
+constexpr static API_ROUTE ApiRoute[]
+{
+    { "/"sv,                         ApiGet_Index,                ApiMethod::Any,    ApiRes::None,    ApiKind::Static,   L"\\index.html"sv },
+    { "/index.html"sv,               ApiGet_Index,                ApiMethod::Any,    ApiRes::None,    ApiKind::Static,   L"\\index.html"sv },
+    { "/article"sv,                  ApiGet_Index,                ApiMethod::Any,    ApiRes::None,    ApiKind::Static,   L"\\index.html"sv },
+    { "/task"sv,                     ApiGet_Index,                ApiMethod::Any,    ApiRes::None,    ApiKind::Static,   L"\\index.html"sv },
+    { "/api/proj_insert"sv,          ApiPost_InsertProject,       ApiMethod::Post,   ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/proj_delete"sv,          ApiPost_DeleteProject,       ApiMethod::Post,   ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/proj_update"sv,          ApiPost_UpdateProject,       ApiMethod::Post,   ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/proj_list"sv,            ApiGet_ProjectList,          ApiMethod::Get,    ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/task_insert"sv,          ApiPost_InsertTask,          ApiMethod::Post,   ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/task_delete"sv,          ApiPost_DeleteTask,          ApiMethod::Post,   ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/task_update"sv,          ApiPost_UpdateTask,          ApiMethod::Post,   ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/task_list"sv,            ApiGet_TaskList,             ApiMethod::Get,    ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/task_comm_insert"sv,     ApiPost_InsertTaskComment,   ApiMethod::Post,   ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/task_comm_delete"sv,     ApiPost_DeleteTaskComment,   ApiMethod::Post,   ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/task_comm_update"sv,     ApiPost_UpdateTaskComment,   ApiMethod::Post,   ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/task_comm_list"sv,       ApiGet_TaskCommentList,      ApiMethod::Get,    ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/task_log"sv,             ApiGet_TaskLogList,          ApiMethod::Get,    ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/task_relation_insert"sv, ApiPost_InsertTaskRelation,  ApiMethod::Post,   ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/task_relation_delete"sv, ApiPost_DeleteTaskRelation,  ApiMethod::Post,   ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/task_relation"sv,        ApiGet_TaskRelationList,     ApiMethod::Get,    ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/page_group_insert"sv,    ApiPost_InsertPageGroup,     ApiMethod::Post,   ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/page_group_delete"sv,    ApiPost_DeletePageGroup,     ApiMethod::Post,   ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/page_group_update"sv,    ApiPost_UpdatePageGroup,     ApiMethod::Post,   ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/page_group_list"sv,      ApiGet_PageGroupList,        ApiMethod::Get,    ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/page_insert"sv,          ApiPost_InsertPage,          ApiMethod::Post,   ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/page_delete"sv,          ApiPost_DeletePage,          ApiMethod::Post,   ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/page_update"sv,          ApiPost_UpdatePage,          ApiMethod::Post,   ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/page_list"sv,            ApiGet_PageList,             ApiMethod::Get,    ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/page_save"sv,            ApiPost_PageSave,            ApiMethod::Post,   ApiResDbPvAuth,  ApiKind::Blocking },
+    { "/api/page_load"sv,            ApiGet_PageLoad,             ApiMethod::Get,    ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/page_version_list"sv,    ApiGet_PageVersionList,      ApiMethod::Get,    ApiResDbPvAuth,  ApiKind::Blocking },
+    { "/api/page_version_content"sv, ApiGet_PageVersionContent,   ApiMethod::Get,    ApiResDbPvAuth,  ApiKind::Blocking },
+    { "/api/login"sv,                ApiGet_Login,                ApiMethod::Get,    ApiRes::Db,      ApiKind::Blocking },
+    { "/api/register"sv,             ApiPost_Register,            ApiMethod::Post,   ApiRes::Db,      ApiKind::Blocking },
+    { "/api/search"sv,               ApiGet_SearchEntity,         ApiMethod::Get,    ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/search_content"sv,       ApiGet_SearchContent,        ApiMethod::Get,    ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/acl"sv,                  ApiGet_Acl,                  ApiMethod::Get,    ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/modify_acl"sv,           ApiPost_ModifyAccess,        ApiMethod::Post,   ApiResDbAuth,    ApiKind::Blocking },
+    { "/api/modify_acl_user"sv,      ApiPost_ModifyAccessUser,    ApiMethod::Post,   ApiResDbAuth,    ApiKind::Blocking },
+};
+
+// 路由表的完美哈希，编译期搜索使所有路由落入不同槽的种子
+// 哈希时折叠大小写，查找时无需复制路径
+constexpr static size_t CsRouteSlotCount = 1024;
+struct CS_ROUTE_TABLE
+{
+    UINT uSeed;
+    size_t cchMaxPath;
+    BYTE idxRoute[CsRouteSlotCount];// 路由索引+1，0表示空槽
 };
+static_assert(ARRAYSIZE(ApiRoute) < 0xFF);
+
+constexpr static UINT CsHashRoute(std::string_view svPath, UINT uSeed) noexcept
+{
+    UINT h = 2166136261u ^ (uSeed * 0x9E3779B9u);
+    for (const auto ch : svPath)
+    {
+        h ^= (BYTE)((ch >= 'A' && ch <= 'Z') ? (ch + ('a' - 'A')) : ch);
+        h *= 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+consteval static CS_ROUTE_TABLE CsBuildRouteTable() noexcept
+{
+    for (UINT uSeed = 0;; ++uSeed)
+    {
+        CS_ROUTE_TABLE Table{ uSeed };
+        BOOL bOk{ TRUE };
+        for (size_t i = 0; i < ARRAYSIZE(ApiRoute); ++i)
+        {
+            Table.cchMaxPath = std::max(Table.cchMaxPath, ApiRoute[i].svPath.size());
+            auto& idx = Table.idxRoute[CsHashRoute(ApiRoute[i].svPath, uSeed) % CsRouteSlotCount];
+            if (idx)
+            {
+                bOk = FALSE;
+                break;
+            }
+            idx = BYTE(i + 1);
+        }
+        if (bOk)
+            return Table;
+    }
+}
+constexpr static auto CsRouteTable = CsBuildRouteTable();
+
+static const API_ROUTE* CsFindRoute(std::string_view svPath) noexcept
+{
+    // 比最长路由还长的路径不可能命中，无需计算哈希
+    if (svPath.size() > CsRouteTable.cchMaxPath)
+        return nullptr;
+    const auto idx = CsRouteTable.idxRoute[
+        CsHashRoute(svPath, CsRouteTable.uSeed) % CsRouteSlotCount];
+    if (!idx)
+        return nullptr;
+    const auto& Route = ApiRoute[idx - 1];
+    if (!eck::TcsEqualLen2I(svPath.data(), svPath.size(),
+        Route.svPath.data(), Route.svPath.size()))
+        return nullptr;
+    return &Route;
+}
+
+static BOOL CsMatchMethod(IHttpServer* pSender, CONNID dwConnId, ApiMethod eMethod) noexcept
+{
+    if (eMethod == ApiMethod::Any)
+        return TRUE;
+    const auto pszMethod = pSender->GetMethod(dwConnId);
+    if (!pszMethod)
+        return FALSE;
+    return std::string_view{ pszMethod } == (eMethod == ApiMethod::Get ? "GET"sv : "POST"sv);
+}
+
+// 访问数据库或读取文件的请求会阻塞，转入线程池执行，入口负责释放此处增加的引用
+static void CsSubmit(const API_CTX& Ctx, FApiEntry pfnEntry) noexcept
+{
+    Ctx.pExtra->IncRef();
+    eck::TpSubmitSimpleCallback(nullptr, [Ctx, pfnEntry](PTP_CALLBACK_INSTANCE) mutable noexcept
+        {
+            pfnEntry(Ctx);
+        });
+}
 
 EnHttpParseResult CServer::OnHeadersComplete(IHttpServer* pSender, CONNID dwConnId)
 {
@@ -78,27 +185,55 @@ EnHttpParseResult CServer::OnMessageComplete(IHttpServer* pSender, CONNID dwConn
     if (!pExtra)
         return HPR_OK;
     const auto pszPath = pSender->GetUrlField(dwConnId, HUF_PATH);
-    const auto cchPath = eck::TcsLen(pszPath);
 
-    eck::CRefStrA rsPathLower(cchPath);
-    for (size_t i{}; auto& e : rsPathLower)
-        e = eck::TchToLower(pszPath[i++]);
-
-    const API_CTX Ctx
+    API_CTX Ctx
     {
         .pSender = pSender,
         .dwConnId = dwConnId,
         .pExtra = pExtra,
     };
 
-    if (cchPath == 1 && *pszPath == '/')
-        return ApiGet_Index(Ctx);
-    const auto it = ApiMap.find(rsPathLower.ToStringView());
-    if (it != ApiMap.end())
-        return it->second(Ctx);
-    return ApiGet_ResourceFile(Ctx);
+    const auto pRoute = CsFindRoute(pszPath ? pszPath : "");
+    if (pRoute)
+    {
+        if (!CsMatchMethod(pSender, dwConnId, pRoute->eMethod))
+        {
+            pSender->SendResponse(dwConnId, HSC_METHOD_NOT_ALLOWED,
+                "Method Not Allowed", nullptr, 0, nullptr, 0);
+            return HPR_OK;
+        }
+        Ctx.eRes = pRoute->eRes;
+        switch (pRoute->eKind)
+        {
+        case ApiKind::Static:
+            if (SrTrySendCached(Ctx, pRoute->svResPath))
+                return HPR_OK;
+            break;
+        case ApiKind::Blocking:
+            ApiParseRequest(Ctx);
+            break;
+        default: ECK_UNREACHABLE;
+        }
+        CsSubmit(Ctx, pRoute->pfnEntry);
+        return HPR_OK;
+    }
 
-#undef TKK_HIT_PATH
+    // 未命中路由的路径视为res\dist下的文件
+    if (!pszPath || !*pszPath)
+    {
+        pSender->SendResponse(dwConnId, HSC_NOT_FOUND, "Not Found",
+            nullptr, 0, nullptr, 0);
+        return HPR_OK;
+    }
+    auto rsPathW = eck::StrU82W(pszPath);
+    if (SrTrySendCached(Ctx, rsPathW.ToStringView()))
+        return HPR_OK;
+    pExtra->IncRef();
+    eck::TpSubmitSimpleCallback(nullptr,
+        [Ctx, rsPathW = std::move(rsPathW)](PTP_CALLBACK_INSTANCE) mutable noexcept
+        {
+            ApiSendResourceFile(Ctx, rsPathW.ToStringView());
+        });
     return HPR_OK;
 }
 
@@ -153,25 +288,3 @@ void CServer::Stop() noexcept
     delete s_pInst;
     s_pInst = nullptr;
 }
-
-ConnectionData::~ConnectionData()
-{
-    if (pSqlite)
-        DbClose(pSqlite);
-    if (pSqlitePv)
-        DbPvClose(pSqlitePv);
-}
-
-int ConnectionData::OpenDatabase() noexcept
-{
-    if (pSqlite)
-        return SQLITE_OK;
-    return DbOpen(pSqlite);
-}
-
-int ConnectionData::OpenPageDatabase() noexcept
-{
-    if (pSqlitePv)
-        return SQLITE_OK;
-    return DbPvOpen(pSqlitePv);
-}
\ No newline at end of file
@@ -3,19 +3,13 @@ struct ConnectionData final
 {
     LONG cRef{ 1 };
     eck::CRefBin rbBody{};
-    sqlite3* pSqlite{};
-    sqlite3* pSqlitePv{};
 
-    ~ConnectionData();
     EckInline void IncRef() noexcept { InterlockedIncrement(&cRef); }
     EckInline void DecRef() noexcept
     {
         if (InterlockedDecrement(&cRef) == 0)
             delete this;
     }
-
-    int OpenDatabase() noexcept;
-    int OpenPageDatabase() noexcept;
 };
 
 class CServer final : public CHttpServerListener
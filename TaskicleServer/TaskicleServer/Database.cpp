@@ -1,36 +1,254 @@
 ﻿#include "pch.h"
 #include "Database.h"
+#include "SearchTokenizer.h"
 
 static eck::CRefStrW s_DbFilePath{};
 static eck::CRefStrW s_DbPvFilePath{};
 
-static std::vector<sqlite3*> s_DbFreeConn{};
-static std::vector<sqlite3*> s_DbPvFreeConn{};
-static eck::CSrwLock s_DbConnLock{};
 
-static BOOL DbpIsTriggerExists(sqlite3* pSqlite, std::string_view svTrigger) noexcept
+// 每个连接可缓存的语句数，超出后新语句不再缓存
+constexpr static size_t DbMaxCachedStmt = 64;
+// 语句缓存在连接上的客户数据名
+constexpr static char DbStmtCacheName[]{ "Tkk.StmtCache" };
+// 当前操作者在连接上的客户数据名，由tkk_current_user()读取
+constexpr static char DbCurrentUserName[]{ "Tkk.CurrentUser" };
+
+// 允许全表扫描的表，均只有一行
+constexpr static std::string_view DbFullScanAllowed[]{ "GlobalId"sv };
+
+// 查找语句中对表或索引的全表扫描，输出被扫描的对象名与所属表名
+// 使用EXPLAIN的字节码而非EXPLAIN QUERY PLAN，后者只给出别名，无法区分CTE、子查询的临时表与真实的表
+static int DbpFindFullScan(sqlite3* pSqlite, std::string_view svSql,
+    std::vector<std::pair<std::string, std::string>>& vScan) noexcept
 {
-    char* pszErrMsg{};
-    constexpr char Sql[]{ R"(
-SELECT COUNT(*) FROM sqlite_master
-WHERE type='trigger' AND name=?
-)" };
+    eck::CRefStrA rsExplain{};
+    rsExplain.PushBack("EXPLAIN "sv).PushBack(svSql);
     sqlite3_stmt* pStmt;
-    auto r = sqlite3_prepare_v3(pSqlite, EckStrAndLen(Sql), 0, &pStmt, nullptr);
+    int r = sqlite3_prepare_v3(pSqlite, rsExplain.Data(), rsExplain.Size(),
+        0, &pStmt, nullptr);
     if (r != SQLITE_OK)
+        return r;
+    std::unordered_map<int, int> hmCursorRoot{};// 游标 -> 主库中的根页
+    std::vector<int> vScanRoot{};
+    while ((r = sqlite3_step(pStmt)) == SQLITE_ROW)
     {
-        LOGE << "Sqlite error: " << r << "(" << sqlite3_errmsg(pSqlite) << ")";
-        return FALSE;
+        const std::string_view svOp{ (PCSTR)sqlite3_column_text(pStmt, 1),
+            (size_t)sqlite3_column_bytes(pStmt, 1) };
+        const auto iCursor = sqlite3_column_int(pStmt, 2);
+        if (svOp == "OpenRead"sv || svOp == "OpenWrite"sv)
+        {
+            if (sqlite3_column_int(pStmt, 4) == 0)// P3为库序号
+                hmCursorRoot.insert_or_assign(iCursor, sqlite3_column_int(pStmt, 3));
+            else
+                hmCursorRoot.erase(iCursor);
+        }
+        else if (svOp.starts_with("Open"sv))
+            hmCursorRoot.erase(iCursor);
+        // 全表扫描循环的Next/Prev以P5标记语句计数器
+        else if ((svOp == "Next"sv || svOp == "Prev"sv) &&
+            sqlite3_column_int(pStmt, 6) == SQLITE_STMTSTATUS_FULLSCAN_STEP)
+        {
+            const auto it = hmCursorRoot.find(iCursor);
+            if (it != hmCursorRoot.end())
+                vScanRoot.emplace_back(it->second);
+        }
     }
-    sqlite3_bind_text(pStmt, 1, svTrigger.data(),
-        (int)svTrigger.size(), SQLITE_STATIC);
-    BOOL b;
-    if (sqlite3_step(pStmt) == SQLITE_ROW)
-        b = !!sqlite3_column_int(pStmt, 0);
-    else
-        b = FALSE;
     sqlite3_finalize(pStmt);
-    return b;
+    if (r != SQLITE_DONE)
+        return r;
+    if (vScanRoot.empty())
+        return SQLITE_OK;
+
+    constexpr char Sql[]{ "SELECT name, tbl_name FROM sqlite_master WHERE rootpage = ?" };
+    r = sqlite3_prepare_v3(pSqlite, EckStrAndLen(Sql), 0, &pStmt, nullptr);
+    if (r != SQLITE_OK)
+        return r;
+    for (const auto iRoot : vScanRoot)
+    {
+        sqlite3_bind_int(pStmt, 1, iRoot);
+        if (sqlite3_step(pStmt) == SQLITE_ROW)
+            vScan.emplace_back((PCSTR)sqlite3_column_text(pStmt, 0),
+                (PCSTR)sqlite3_column_text(pStmt, 1));
+        sqlite3_reset(pStmt);
+    }
+    sqlite3_finalize(pStmt);
+    return SQLITE_OK;
+}
+
+// TKK_DB_SQL登记的语句，静态初始化时头插，链表头须为常量初始化
+constinit static const DB_SQL_REG* s_pDbSqlReg{};
+
+BOOL DbRegisterSql(DB_SQL_REG& Reg) noexcept
+{
+    Reg.pNext = s_pDbSqlReg;
+    s_pDbSqlReg = &Reg;
+    return TRUE;
+}
+
+// 检查指定库上登记的全部语句，有未允许的全表扫描或无法编译时返回SQLITE_ERROR
+static int DbpCheckQueryPlan(sqlite3* pSqlite, BOOL bPageDb) noexcept
+{
+    int r{ SQLITE_OK };
+    size_t cStmt{}, cFailed{};
+    std::vector<std::pair<std::string, std::string>> vScan{};
+    for (auto p = s_pDbSqlReg; p; p = p->pNext)
+    {
+        if (p->bPageDb != bPageDb)
+            continue;
+        ++cStmt;
+        vScan.clear();
+        const auto r1 = DbpFindFullScan(pSqlite, p->svSql, vScan);
+        if (r1 != SQLITE_OK)
+        {
+            LOGE << "Check query plan failed: " << r1 << "(" << sqlite3_errmsg(pSqlite)
+                << "): " << std::string{ p->svSql };
+            ++cFailed;
+            continue;
+        }
+        for (const auto& [Name, Table] : vScan)
+        {
+            if (std::find(std::begin(DbFullScanAllowed), std::end(DbFullScanAllowed),
+                Table) != std::end(DbFullScanAllowed))
+                continue;
+            LOGE << "Full scan on " << Name << ": " << std::string{ p->svSql };
+            ++cFailed;
+        }
+    }
+    if (cFailed)
+        r = SQLITE_ERROR;
+    LOGI << "Checked query plan of " << cStmt << " statements, "
+        << cFailed << " failed";
+    return r;
+}
+
+// 连接的预编译语句缓存
+// 连接由连接池独占借出，同一时刻只由借出它的线程使用，因此不加锁
+// 借出与归还时记录持有线程，调试版本中检查是否被其他线程使用
+class CDbStmtCache
+{
+private:
+    struct ITEM
+    {
+        sqlite3_stmt* pStmt;
+        BOOL bInUse;
+    };
+    struct HASH
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view sv) const noexcept
+        {
+            return std::hash<std::string_view>{}(sv);
+        }
+    };
+
+    std::unordered_map<std::string, ITEM, HASH, std::equal_to<>> m_Stmt{};
+    std::unordered_map<sqlite3_stmt*, ITEM*> m_StmtToItem{};
+    DWORD m_tidOwner{};
+public:
+    ~CDbStmtCache()
+    {
+        for (const auto& e : m_Stmt)
+            sqlite3_finalize(e.second.pStmt);
+    }
+
+    void OnLease() noexcept
+    {
+        EckAssert(!m_tidOwner);
+        m_tidOwner = GetCurrentThreadId();
+    }
+    void OnReturn() noexcept
+    {
+        EckAssert(m_tidOwner == GetCurrentThreadId());
+        m_tidOwner = 0;
+    }
+
+    int Prepare(sqlite3* pSqlite, std::string_view svSql,
+        _Out_ sqlite3_stmt*& pStmt) noexcept
+    {
+        EckAssert(m_tidOwner == GetCurrentThreadId());
+        const auto it = m_Stmt.find(svSql);
+        if (it != m_Stmt.end())
+        {
+            // 正在使用（如嵌套调用），退化为普通语句
+            if (!it->second.bInUse)
+            {
+                it->second.bInUse = TRUE;
+                pStmt = it->second.pStmt;
+                return SQLITE_OK;
+            }
+        }
+        const auto r = sqlite3_prepare_v3(pSqlite, svSql.data(), (int)svSql.size(),
+            SQLITE_PREPARE_PERSISTENT, &pStmt, nullptr);
+        if (r != SQLITE_OK || it != m_Stmt.end() ||
+            m_Stmt.size() >= DbMaxCachedStmt)
+            return r;
+        auto& Item = m_Stmt.emplace(std::string{ svSql },
+            ITEM{ pStmt, TRUE }).first->second;
+        m_StmtToItem.emplace(pStmt, &Item);
+        return r;
+    }
+
+    void Release(sqlite3_stmt* pStmt) noexcept
+    {
+        EckAssert(m_tidOwner == GetCurrentThreadId());
+        const auto it = m_StmtToItem.find(pStmt);
+        if (it == m_StmtToItem.end())
+        {
+            sqlite3_finalize(pStmt);
+            return;
+        }
+        EckAssert(it->second->bInUse);
+        sqlite3_reset(pStmt);
+        sqlite3_clear_bindings(pStmt);
+        it->second->bInUse = FALSE;
+    }
+};
+
+static CDbStmtCache* DbpGetStmtCache(sqlite3* pSqlite) noexcept
+{
+    auto pCache = (CDbStmtCache*)sqlite3_get_clientdata(pSqlite, DbStmtCacheName);
+    if (!pCache)
+    {
+        pCache = new CDbStmtCache{};
+        sqlite3_set_clientdata(pSqlite, DbStmtCacheName, pCache,
+            [](void* p) { delete (CDbStmtCache*)p; });
+    }
+    return pCache;
+}
+
+// 关闭连接，缓存的语句须先于连接销毁
+static void DbpClose(sqlite3* pSqlite) noexcept
+{
+    sqlite3_set_clientdata(pSqlite, DbStmtCacheName, nullptr, nullptr);
+    sqlite3_close(pSqlite);
+}
+
+// 打开或初始化失败时关闭连接，sqlite3_open16失败时通常也已分配句柄
+static void DbpCloseFailed(sqlite3*& pSqlite) noexcept
+{
+    if (pSqlite)
+    {
+        DbpClose(pSqlite);
+        pSqlite = nullptr;
+    }
+}
+
+int DbPrepare(sqlite3* pSqlite, std::string_view svSql,
+    _Out_ sqlite3_stmt*& pStmt) noexcept
+{
+    return DbpGetStmtCache(pSqlite)->Prepare(pSqlite, svSql, pStmt);
+}
+
+void DbFinalize(sqlite3_stmt* pStmt) noexcept
+{
+    if (!pStmt)
+        return;
+    const auto pCache = (CDbStmtCache*)sqlite3_get_clientdata(
+        sqlite3_db_handle(pStmt), DbStmtCacheName);
+    if (pCache)
+        pCache->Release(pStmt);
+    else
+        sqlite3_finalize(pStmt);
 }
 
 static int DbpTableCreateUser(sqlite3* pSqlite) noexcept
@@ -56,6 +274,9 @@ CREATE TABLE IF NOT EXISTS UserSession (
     user_id         INTEGER     NOT NULL,
     expire_at       INTEGER     NOT NULL
 );
+
+CREATE INDEX IF NOT EXISTS IdxUserSession_UserId ON UserSession(user_id);
+CREATE INDEX IF NOT EXISTS IdxUserSession_ExpireAt ON UserSession(expire_at);
 )";
     char* pszErrMsg{};
     const int r = sqlite3_exec(pSqlite, Sql, nullptr, nullptr, &pszErrMsg);
@@ -75,7 +296,8 @@ CREATE TABLE IF NOT EXISTS Project (
     create_at       INTEGER     NOT NULL DEFAULT (CAST(unixepoch('subsecond') * 1000 AS INTEGER))
 );
 
-CREATE INDEX IF NOT EXISTS IdxProject_Name ON Project(project_id);
+DROP INDEX IF EXISTS IdxProject_Name;
+CREATE INDEX IF NOT EXISTS IdxProject_ProjectName ON Project(project_name);
 )";
     char* pszErrMsg{};
     const int r = sqlite3_exec(pSqlite, Sql, nullptr, nullptr, &pszErrMsg);
@@ -106,7 +328,8 @@ CREATE TABLE IF NOT EXISTS Task (
     FOREIGN KEY(creator_id) REFERENCES User(user_id)
 );
 
-CREATE INDEX IF NOT EXISTS IdxTask_TaskProjId ON Task(task_id, project_id);
+DROP INDEX IF EXISTS IdxTask_TaskProjId;
+CREATE INDEX IF NOT EXISTS IdxTask_ProjectId ON Task(project_id);
 
 CREATE TABLE IF NOT EXISTS TaskLog (
     id              INTEGER     PRIMARY KEY AUTOINCREMENT,
@@ -120,6 +343,8 @@ CREATE TABLE IF NOT EXISTS TaskLog (
     FOREIGN KEY(user_id) REFERENCES User(user_id)
 );
 
+CREATE INDEX IF NOT EXISTS IdxTaskLog_TaskChangeAt ON TaskLog(task_id, change_at);
+
 CREATE TABLE IF NOT EXISTS TaskComment (
     comm_id         INTEGER     PRIMARY KEY,
     task_id         INTEGER     NOT NULL,
@@ -131,7 +356,8 @@ CREATE TABLE IF NOT EXISTS TaskComment (
     FOREIGN KEY(user_id) REFERENCES User(user_id)
 );
 
-CREATE INDEX IF NOT EXISTS IdxTaskComment_TaskId ON TaskComment(task_id);
+DROP INDEX IF EXISTS IdxTaskComment_TaskId;
+CREATE INDEX IF NOT EXISTS IdxTaskComment_TaskCreateAt ON TaskComment(task_id, create_at);
 
 CREATE TABLE IF NOT EXISTS TaskRelation (
     task_id         INTEGER     NOT NULL,
@@ -141,7 +367,7 @@ CREATE TABLE IF NOT EXISTS TaskRelation (
     FOREIGN KEY(task_id) REFERENCES Task(task_id)
 );
 
-CREATE INDEX IF NOT EXISTS IdxTaskRelation_TaskRelationId ON TaskRelation(task_id, relation_id);
+DROP INDEX IF EXISTS IdxTaskRelation_TaskRelationId;
 )";
     char* pszErrMsg{};
     int r = sqlite3_exec(pSqlite, Sql, nullptr, nullptr, &pszErrMsg);
@@ -153,76 +379,45 @@ CREATE INDEX IF NOT EXISTS IdxTaskRelation_TaskRelationId ON TaskRelation(task_i
     }
     return r;
 }
+// 记录任务字段的修改，操作者由tkk_current_user()取得
 static int DbpTriggerCreateTask(sqlite3* pSqlite) noexcept
 {
-    char* pszErrMsg{};
-    auto FnCreateTrigger = [&](std::string_view svTriggerName, std::string_view svFieldName) -> int
-        {
-            if (DbpIsTriggerExists(pSqlite, svTriggerName))
-                return SQLITE_OK;
-            eck::CRefStrA rsSql{};
-            rsSql
-                .PushBack("CREATE TEMP TRIGGER IF NOT EXISTS "sv).PushBack(svTriggerName)
-                .PushBack(" AFTER UPDATE ON Task WHEN OLD."sv)
-                .PushBack(svFieldName).PushBack(" IS NOT NEW."sv).PushBack(svFieldName)
-                .PushBack(" BEGIN "sv)
-                .PushBack("INSERT INTO TaskLog(task_id, field_name, old_value, new_value, user_id)"sv)
-                .PushBack("VALUES (OLD.task_id, '"sv).PushBack(svFieldName)
-                .PushBack("', OLD."sv).PushBack(svFieldName)
-                .PushBack(", NEW."sv).PushBack(svFieldName)
-                .PushBack(", (SELECT user_id FROM TempUserId)); END;"sv);
-            const auto r = sqlite3_exec(pSqlite, rsSql.Data(), nullptr, nullptr, &pszErrMsg);
-            if (r != SQLITE_OK)
-            {
-                LOGE << "Sqlite error on " << svTriggerName << ": " << r << "(" << pszErrMsg << ")";
-                sqlite3_free(pszErrMsg);
-            }
-            return r;
-        };
-    int r;
-    if ((r = FnCreateTrigger("TrUpdateTask_ProjectId"sv, "project_id"sv)) != SQLITE_OK)
-    {
-        LOGE << "Sqlite error: " << r << "(" << pszErrMsg << ")";
-        sqlite3_free(pszErrMsg);
-        return r;
-    }
-    if ((r = FnCreateTrigger("TrUpdateTask_TaskName"sv, "task_name"sv)) != SQLITE_OK)
-    {
-        LOGE << "Sqlite error: " << r << "(" << pszErrMsg << ")";
-        sqlite3_free(pszErrMsg);
-        return r;
-    }
-    if ((r = FnCreateTrigger("TrUpdateTask_Status"sv, "status"sv)) != SQLITE_OK)
-    {
-        LOGE << "Sqlite error: " << r << "(" << pszErrMsg << ")";
-        sqlite3_free(pszErrMsg);
-        return r;
-    }
-    if ((r = FnCreateTrigger("TrUpdateTask_Priority"sv, "priority"sv)) != SQLITE_OK)
+    struct TASK_LOG_FIELD
     {
-        LOGE << "Sqlite error: " << r << "(" << pszErrMsg << ")";
-        sqlite3_free(pszErrMsg);
-        return r;
-    }
-    if ((r = FnCreateTrigger("TrUpdateTask_Description"sv, "description"sv)) != SQLITE_OK)
+        std::string_view svTrigger;
+        std::string_view svField;
+    };
+    constexpr TASK_LOG_FIELD Field[]
     {
-        LOGE << "Sqlite error: " << r << "(" << pszErrMsg << ")";
-        sqlite3_free(pszErrMsg);
-        return r;
-    }
-    if ((r = FnCreateTrigger("TrUpdateTask_ExpireAt"sv, "expire_at"sv)) != SQLITE_OK)
+        { "TrUpdateTask_ProjectId"sv,   "project_id"sv },
+        { "TrUpdateTask_TaskName"sv,    "task_name"sv },
+        { "TrUpdateTask_Status"sv,      "status"sv },
+        { "TrUpdateTask_Priority"sv,    "priority"sv },
+        { "TrUpdateTask_Description"sv, "description"sv },
+        { "TrUpdateTask_ExpireAt"sv,    "expire_at"sv },
+        { "TrUpdateTask_AssigneeId"sv,  "assignee_id"sv },
+    };
+    eck::CRefStrA rsSql{};
+    for (const auto& e : Field)
+        rsSql
+            .PushBack("CREATE TRIGGER IF NOT EXISTS "sv).PushBack(e.svTrigger)
+            .PushBack(" AFTER UPDATE ON Task WHEN OLD."sv)
+            .PushBack(e.svField).PushBack(" IS NOT NEW."sv).PushBack(e.svField)
+            .PushBack(" BEGIN "sv)
+            .PushBack("INSERT INTO TaskLog(task_id, field_name, old_value, new_value, user_id)"sv)
+            .PushBack("VALUES (OLD.task_id, '"sv).PushBack(e.svField)
+            .PushBack("', OLD."sv).PushBack(e.svField)
+            .PushBack(", NEW."sv).PushBack(e.svField)
+            .PushBack(", tkk_current_user()); END;\n"sv);
+
+    char* pszErrMsg{};
+    const int r = sqlite3_exec(pSqlite, rsSql.Data(), nullptr, nullptr, &pszErrMsg);
+    if (r != SQLITE_OK)
     {
         LOGE << "Sqlite error: " << r << "(" << pszErrMsg << ")";
         sqlite3_free(pszErrMsg);
-        return r;
     }
-    if ((r = FnCreateTrigger("TrUpdateTask_AssigneeId"sv, "assignee_id"sv)) != SQLITE_OK)
-    {
-        LOGE << "Sqlite error: " << r << "(" << pszErrMsg << ")";
-        sqlite3_free(pszErrMsg);
-        return r;
-    }
-    return SQLITE_OK;
+    return r;
 }
 static int DbpTableCreatePageGroup(sqlite3* pSqlite) noexcept
 {
@@ -254,7 +449,8 @@ CREATE TABLE IF NOT EXISTS Page (
     FOREIGN KEY(page_group_id) REFERENCES PageGroup(page_group_id)
 );
 
-CREATE INDEX IF NOT EXISTS IdxPage_PageId ON Page(page_id, page_group_id);
+DROP INDEX IF EXISTS IdxPage_PageId;
+CREATE INDEX IF NOT EXISTS IdxPage_PageGroupId ON Page(page_group_id);
 
 CREATE TABLE IF NOT EXISTS PageVersion (
     page_ver_id     INTEGER     PRIMARY KEY AUTOINCREMENT,
@@ -305,7 +501,8 @@ CREATE TABLE IF NOT EXISTS Acl (
     FOREIGN KEY(user_id) REFERENCES User(user_id)
 );
 
-CREATE INDEX IF NOT EXISTS IdxAcl_TargetType ON Acl(user_id, entity_id);
+DROP INDEX IF EXISTS IdxAcl_TargetType;
+CREATE INDEX IF NOT EXISTS IdxAcl_EntityId ON Acl(entity_id);
 )";
     char* pszErrMsg{};
     const int r = sqlite3_exec(pSqlite, Sql, nullptr, nullptr, &pszErrMsg);
@@ -338,38 +535,495 @@ CREATE TABLE IF NOT EXISTS TaskComment (
     }
     return r;
 }
-static int DbpViewCreateCoreEntity(sqlite3* pSqlite) noexcept
+// 取表的建表语句，表不存在时返回FALSE
+static BOOL DbpGetTableSql(sqlite3* pSqlite, std::string_view svTable,
+    eck::CRefStrA& rsSql) noexcept
 {
-    constexpr auto Sql = R"(
-CREATE VIEW IF NOT EXISTS CoreEntity AS
-    SELECT
-        page_group_id  AS entity_id,
-        1              AS type,
-        group_name     AS name,
-        create_at,
-        -1             AS container_id
-    FROM PageGroup
-UNION ALL
-    SELECT page_id,    2, page_name,    create_at, page_group_id
-    FROM Page
-UNION ALL          
-    SELECT project_id, 3, project_name, create_at, -1
-    FROM Project       
-UNION ALL          
-    SELECT task_id,    4, task_name,    create_at, project_id
-    FROM Task
-;
-)";
+    constexpr char Sql[]{ R"(
+SELECT sql FROM sqlite_master
+WHERE type='table' AND name=?
+)" };
+    sqlite3_stmt* pStmt;
+    auto r = sqlite3_prepare_v3(pSqlite, EckStrAndLen(Sql), 0, &pStmt, nullptr);
+    if (r != SQLITE_OK)
+    {
+        LOGE << "Sqlite error: " << r << "(" << sqlite3_errmsg(pSqlite) << ")";
+        return FALSE;
+    }
+    sqlite3_bind_text(pStmt, 1, svTable.data(),
+        (int)svTable.size(), SQLITE_STATIC);
+    BOOL b;
+    if (sqlite3_step(pStmt) == SQLITE_ROW)
+    {
+        b = TRUE;
+        rsSql.Clear();
+        rsSql.PushBack(
+            (PCSTR)sqlite3_column_text(pStmt, 0),
+            sqlite3_column_bytes(pStmt, 0));
+    }
+    else
+        b = FALSE;
+    sqlite3_finalize(pStmt);
+    return b;
+}
+
+struct DB_ENTITY_SOURCE
+{
+    std::string_view svTable;
+    std::string_view svId;
+    std::string_view svName;
+    std::string_view svContainer;// 为空时容器为-1
+    std::string_view svType;
+    BOOL bUser;// 用户不是实体，仅进入名称索引，以负的用户ID存储
+};
+constexpr static DB_ENTITY_SOURCE DbEntitySource[]
+{
+    { "PageGroup"sv, "page_group_id"sv, "group_name"sv,   {},                 "1"sv, FALSE },
+    { "Page"sv,      "page_id"sv,       "page_name"sv,    "page_group_id"sv,  "2"sv, FALSE },
+    { "Project"sv,   "project_id"sv,    "project_name"sv, {},                 "3"sv, FALSE },
+    { "Task"sv,      "task_id"sv,       "task_name"sv,    "project_id"sv,     "4"sv, FALSE },
+    { "User"sv,      "user_id"sv,       "user_name"sv,    {},                 "5"sv, TRUE },
+};
+
+static void DbpPushEntityContainer(eck::CRefStrA& rsSql,
+    const DB_ENTITY_SOURCE& e, std::string_view svRow) noexcept
+{
+    if (e.svContainer.empty())
+        rsSql.PushBack("-1"sv);
+    else
+        rsSql.PushBack(svRow).PushBack(e.svContainer);
+}
+
+// 页面组、页面、项目、任务的公共属性，由触发器随各表同步
+// 跨类型的查询与容器查找通过主键或索引完成，无需合并四张表
+static int DbpTableCreateEntity(sqlite3* pSqlite) noexcept
+{
+    eck::CRefStrA rsSql{};
+    const auto bPopulate = !DbpGetTableSql(pSqlite, "Entity"sv, rsSql);
+    rsSql.Clear();
+    rsSql.PushBack(R"(
+DROP VIEW IF EXISTS CoreEntity;
+CREATE TABLE IF NOT EXISTS Entity (
+    entity_id       INTEGER     PRIMARY KEY,
+    type            INTEGER     NOT NULL,
+    name            TEXT        NOT NULL,
+    container_id    INTEGER     NOT NULL,
+    create_at       INTEGER     NOT NULL
+);
+
+CREATE INDEX IF NOT EXISTS IdxEntity_ContainerType ON Entity(container_id, type);
+CREATE INDEX IF NOT EXISTS IdxEntity_Name ON Entity(name);
+)"sv);
+    for (const auto& e : DbEntitySource)
+    {
+        if (e.bUser)
+            continue;
+        // 新增
+        rsSql.PushBack("CREATE TRIGGER IF NOT EXISTS TrEntityInsert"sv).PushBack(e.svTable)
+            .PushBack(" AFTER INSERT ON "sv).PushBack(e.svTable)
+            .PushBack(" BEGIN INSERT INTO Entity(entity_id, type, name, container_id, create_at) VALUES (NEW."sv)
+            .PushBack(e.svId)
+            .PushBack(", "sv).PushBack(e.svType)
+            .PushBack(", NEW."sv).PushBack(e.svName)
+            .PushBack(", "sv);
+        DbpPushEntityContainer(rsSql, e, "NEW."sv);
+        rsSql.PushBack(", NEW.create_at); END;\n"sv);
+        // 重命名或移动
+        rsSql.PushBack("CREATE TRIGGER IF NOT EXISTS TrEntityUpdate"sv).PushBack(e.svTable)
+            .PushBack(" AFTER UPDATE OF "sv).PushBack(e.svName);
+        if (!e.svContainer.empty())
+            rsSql.PushBack(", "sv).PushBack(e.svContainer);
+        rsSql.PushBack(" ON "sv).PushBack(e.svTable)
+            .PushBack(" BEGIN UPDATE Entity SET name = NEW."sv).PushBack(e.svName)
+            .PushBack(", container_id = "sv);
+        DbpPushEntityContainer(rsSql, e, "NEW."sv);
+        rsSql.PushBack(" WHERE entity_id = OLD."sv).PushBack(e.svId)
+            .PushBack("; END;\n"sv);
+        // 删除
+        rsSql.PushBack("CREATE TRIGGER IF NOT EXISTS TrEntityDelete"sv).PushBack(e.svTable)
+            .PushBack(" AFTER DELETE ON "sv).PushBack(e.svTable)
+            .PushBack(" BEGIN DELETE FROM Entity WHERE entity_id = OLD."sv).PushBack(e.svId)
+            .PushBack("; END;\n"sv);
+        // 首次创建时载入已有数据
+        if (bPopulate)
+        {
+            rsSql.PushBack("INSERT INTO Entity(entity_id, type, name, container_id, create_at) SELECT "sv)
+                .PushBack(e.svId)
+                .PushBack(", "sv).PushBack(e.svType)
+                .PushBack(", "sv).PushBack(e.svName)
+                .PushBack(", "sv);
+            DbpPushEntityContainer(rsSql, e, {});
+            rsSql.PushBack(", create_at FROM "sv).PushBack(e.svTable).PushBack(";\n"sv);
+        }
+    }
+
     char* pszErrMsg{};
-    const int r = sqlite3_exec(pSqlite, Sql, nullptr, nullptr, &pszErrMsg);
+    const int r = sqlite3_exec(pSqlite, rsSql.Data(), nullptr, nullptr, &pszErrMsg);
+    if (r != SQLITE_OK)
+    {
+        LOGE << "Sqlite error: " << r << "(" << pszErrMsg << ")";
+        sqlite3_free(pszErrMsg);
+    }
+    return r;
+}
+
+// 实体名称的全文索引，由触发器随实体表增量维护
+// rowid为实体ID，用户以负的用户ID存储，避免与实体ID冲突
+static int DbpTableCreateEntityFts(sqlite3* pSqlite) noexcept
+{
+    eck::CRefStrA rsSql{};
+    const auto bExists = DbpGetTableSql(pSqlite, "EntityFts"sv, rsSql);
+    // 以其他分词器建立的索引须删除重建
+    const auto bRebuild = bExists && !strstr(rsSql.Data(), StFtsTokenizerName);
+    const auto bPopulate = !bExists || bRebuild;
+    rsSql.Clear();
+    if (bRebuild)
+        rsSql.PushBack("DROP TABLE EntityFts;\n"sv);
+    rsSql.PushBack(R"(
+CREATE VIRTUAL TABLE IF NOT EXISTS EntityFts USING fts5(
+    name,
+    type            UNINDEXED,
+    create_at       UNINDEXED,
+    container_id    UNINDEXED,
+    tokenize = ')"sv).PushBack(StFtsTokenizerName).PushBack(R"(',
+    prefix = '2 3'
+);
+)"sv);
+    for (const auto& e : DbEntitySource)
+    {
+        const auto svSign = (e.bUser ? "-"sv : ""sv);
+        // 新增
+        rsSql.PushBack("CREATE TRIGGER IF NOT EXISTS TrFtsInsert"sv).PushBack(e.svTable)
+            .PushBack(" AFTER INSERT ON "sv).PushBack(e.svTable)
+            .PushBack(" BEGIN INSERT INTO EntityFts(rowid, name, type, create_at, container_id) VALUES ("sv)
+            .PushBack(svSign).PushBack("NEW."sv).PushBack(e.svId)
+            .PushBack(", NEW."sv).PushBack(e.svName)
+            .PushBack(", "sv).PushBack(e.svType)
+            .PushBack(", NEW.create_at, "sv);
+        DbpPushEntityContainer(rsSql, e, "NEW."sv);
+        rsSql.PushBack("); END;\n"sv);
+        // 重命名或移动
+        rsSql.PushBack("CREATE TRIGGER IF NOT EXISTS TrFtsUpdate"sv).PushBack(e.svTable)
+            .PushBack(" AFTER UPDATE OF "sv).PushBack(e.svName);
+        if (!e.svContainer.empty())
+            rsSql.PushBack(", "sv).PushBack(e.svContainer);
+        rsSql.PushBack(" ON "sv).PushBack(e.svTable)
+            .PushBack(" BEGIN UPDATE EntityFts SET name = NEW."sv).PushBack(e.svName)
+            .PushBack(", container_id = "sv);
+        DbpPushEntityContainer(rsSql, e, "NEW."sv);
+        rsSql.PushBack(" WHERE rowid = "sv).PushBack(svSign).PushBack("OLD."sv).PushBack(e.svId)
+            .PushBack("; END;\n"sv);
+        // 删除
+        rsSql.PushBack("CREATE TRIGGER IF NOT EXISTS TrFtsDelete"sv).PushBack(e.svTable)
+            .PushBack(" AFTER DELETE ON "sv).PushBack(e.svTable)
+            .PushBack(" BEGIN DELETE FROM EntityFts WHERE rowid = "sv)
+            .PushBack(svSign).PushBack("OLD."sv).PushBack(e.svId)
+            .PushBack("; END;\n"sv);
+        // 首次创建时为已有数据建立索引
+        if (bPopulate)
+        {
+            rsSql.PushBack("INSERT INTO EntityFts(rowid, name, type, create_at, container_id) SELECT "sv)
+                .PushBack(svSign).PushBack(e.svId)
+                .PushBack(", "sv).PushBack(e.svName)
+                .PushBack(", "sv).PushBack(e.svType)
+                .PushBack(", create_at, "sv);
+            DbpPushEntityContainer(rsSql, e, {});
+            rsSql.PushBack(" FROM "sv).PushBack(e.svTable).PushBack(";\n"sv);
+        }
+    }
+
+    char* pszErrMsg{};
+    const int r = sqlite3_exec(pSqlite, rsSql.Data(), nullptr, nullptr, &pszErrMsg);
+    if (r != SQLITE_OK)
+    {
+        LOGE << "Sqlite error: " << r << "(" << pszErrMsg << ")";
+        sqlite3_free(pszErrMsg);
+    }
+    return r;
+}
+
+// ContentFts的rowid为来源ID乘4加DbContentKind，页面正文、任务描述与评论共用一个索引
+EckInlineNdCe LONGLONG DbpContentFtsRowId(int iId, DbContentKind eKind) noexcept
+{
+    return (LONGLONG)iId * 4 + (LONGLONG)eKind;
+}
+
+static int DbpContentFtsInsertPage(sqlite3* pSqlite, int iPageId,
+    std::string_view svBody) noexcept
+{
+    constexpr auto& Sql = TKK_DB_SQL(R"(
+INSERT OR REPLACE INTO ContentFts(rowid, body, kind, entity_id)
+VALUES (?1, ?2, ?3, ?4)
+)");
+    sqlite3_stmt* pStmt;
+    int r = DbPrepare(pSqlite, Sql, pStmt);
+    if (r != SQLITE_OK)
+        return r;
+    sqlite3_bind_int64(pStmt, 1, DbpContentFtsRowId(iPageId, DbContentKind::Page));
+    sqlite3_bind_text(pStmt, 2, svBody.data(), (int)svBody.size(), SQLITE_STATIC);
+    sqlite3_bind_int(pStmt, 3, (int)DbContentKind::Page);
+    sqlite3_bind_int(pStmt, 4, iPageId);
+    r = sqlite3_step(pStmt);
+    if (r == SQLITE_DONE)
+        r = SQLITE_OK;
+    DbFinalize(pStmt);
+    return r;
+}
+
+// 页面正文保存在文件中，首次建立索引时逐个读入
+static int DbpContentFtsPopulatePage(sqlite3* pSqlite) noexcept
+{
+    sqlite3_stmt* pStmt;
+    int r = sqlite3_prepare_v3(pSqlite, EckStrAndLen("SELECT page_id FROM Page"),
+        0, &pStmt, nullptr);
+    if (r != SQLITE_OK)
+        return r;
+    eck::CRefStrW rsPath{};
+    while ((r = sqlite3_step(pStmt)) == SQLITE_ROW)
+    {
+        const auto iPageId = sqlite3_column_int(pStmt, 0);
+        rsPath = eck::GetRunningPath();
+        rsPath.PushBackFormat(LR"(\res\page\%d\content.txt)", iPageId);
+        NTSTATUS nts;
+        const auto rbContent = eck::ReadInFile(rsPath.Data(), &nts);
+        // 尚未保存过版本的页面没有正文
+        if (!NT_SUCCESS(nts))
+            continue;
+        r = DbpContentFtsInsertPage(pSqlite, iPageId,
+            { (PCSTR)rbContent.Data(), rbContent.Size() });
+        if (r != SQLITE_OK)
+            break;
+    }
+    sqlite3_finalize(pStmt);
+    return r == SQLITE_DONE ? SQLITE_OK : r;
+}
+
+// 页面正文、任务描述与评论的全文索引
+// 任务描述与评论由触发器维护，页面正文由保存版本时调用DbContentFtsSetPage更新
+// 评论以所属任务作为实体，检索时按任务的权限过滤
+static int DbpTableCreateContentFts(sqlite3* pSqlite) noexcept
+{
+    eck::CRefStrA rsSql{};
+    const auto bExists = DbpGetTableSql(pSqlite, "ContentFts"sv, rsSql);
+    rsSql.Clear();
+    rsSql.PushBack(R"(
+CREATE VIRTUAL TABLE IF NOT EXISTS ContentFts USING fts5(
+    body,
+    kind            UNINDEXED,
+    entity_id       UNINDEXED,
+    tokenize = ')"sv).PushBack(StFtsTokenizerName).PushBack(R"('
+);
+
+CREATE TRIGGER IF NOT EXISTS TrFtsContentInsertTask AFTER INSERT ON Task BEGIN
+    INSERT INTO ContentFts(rowid, body, kind, entity_id)
+    VALUES (NEW.task_id * 4 + 1, NEW.description, 1, NEW.task_id);
+END;
+CREATE TRIGGER IF NOT EXISTS TrFtsContentUpdateTask AFTER UPDATE OF description ON Task BEGIN
+    UPDATE ContentFts SET body = NEW.description WHERE rowid = OLD.task_id * 4 + 1;
+END;
+CREATE TRIGGER IF NOT EXISTS TrFtsContentDeleteTask AFTER DELETE ON Task BEGIN
+    DELETE FROM ContentFts WHERE rowid = OLD.task_id * 4 + 1;
+END;
+
+CREATE TRIGGER IF NOT EXISTS TrFtsContentInsertTaskComment AFTER INSERT ON TaskComment BEGIN
+    INSERT INTO ContentFts(rowid, body, kind, entity_id)
+    VALUES (NEW.comm_id * 4 + 2, NEW.content, 2, NEW.task_id);
+END;
+CREATE TRIGGER IF NOT EXISTS TrFtsContentUpdateTaskComment AFTER UPDATE OF content ON TaskComment BEGIN
+    UPDATE ContentFts SET body = NEW.content WHERE rowid = OLD.comm_id * 4 + 2;
+END;
+CREATE TRIGGER IF NOT EXISTS TrFtsContentDeleteTaskComment AFTER DELETE ON TaskComment BEGIN
+    DELETE FROM ContentFts WHERE rowid = OLD.comm_id * 4 + 2;
+END;
+
+CREATE TRIGGER IF NOT EXISTS TrFtsContentDeletePage AFTER DELETE ON Page BEGIN
+    DELETE FROM ContentFts WHERE rowid = OLD.page_id * 4;
+END;
+)"sv);
+    // 首次创建时为已有数据建立索引
+    if (!bExists)
+        rsSql.PushBack(R"(
+INSERT INTO ContentFts(rowid, body, kind, entity_id)
+SELECT task_id * 4 + 1, description, 1, task_id FROM Task;
+INSERT INTO ContentFts(rowid, body, kind, entity_id)
+SELECT comm_id * 4 + 2, content, 2, task_id FROM TaskComment;
+)"sv);
+
+    char* pszErrMsg{};
+    int r = sqlite3_exec(pSqlite, rsSql.Data(), nullptr, nullptr, &pszErrMsg);
     if (r != SQLITE_OK)
     {
         LOGE << "Sqlite error: " << r << "(" << pszErrMsg << ")";
         sqlite3_free(pszErrMsg);
+        return r;
+    }
+    if (!bExists)
+    {
+        r = DbpContentFtsPopulatePage(pSqlite);
+        if (r != SQLITE_OK)
+            LOGE << "Sqlite error: " << r << "(" << sqlite3_errmsg(pSqlite) << ")";
+    }
+    return r;
+}
+
+// 每个库最多打开的连接数
+constexpr static size_t DbMaxConnection = 32;
+// 连接均已借出时的最长等待时间
+constexpr static DWORD DbLeaseTimeout = 6000;
+
+// 连接池，按请求借出连接，连接数达到上限时等待其他请求归还
+class CDbPool
+{
+private:
+    using FOpen = int(*)(_Out_ sqlite3*& pSqlite) noexcept;
+
+    SRWLOCK m_Lk{ SRWLOCK_INIT };
+    CONDITION_VARIABLE m_cv{ CONDITION_VARIABLE_INIT };
+    std::vector<sqlite3*> m_vFree{};
+    FOpen m_pfnOpen{};
+    size_t m_cOpened{};// 含已借出的连接
+    size_t m_cWaiting{};
+    ULONGLONG m_cLease{};
+    ULONGLONG m_cWait{};
+    ULONGLONG m_cTimeout{};
+    ULONGLONG m_msWait{};
+public:
+    CDbPool(FOpen pfnOpen) noexcept : m_pfnOpen{ pfnOpen } {}
+
+    int Lease(_Out_ sqlite3*& pSqlite) noexcept
+    {
+        pSqlite = nullptr;
+        ULONGLONG tStart{};
+        AcquireSRWLockExclusive(&m_Lk);
+        ++m_cLease;
+        for (;;)
+        {
+            if (!m_vFree.empty())
+            {
+                pSqlite = m_vFree.back();
+                m_vFree.pop_back();
+                break;
+            }
+            if (m_cOpened < DbMaxConnection)
+            {
+                ++m_cOpened;
+                ReleaseSRWLockExclusive(&m_Lk);
+                const auto r = m_pfnOpen(pSqlite);
+                if (r != SQLITE_OK)
+                {
+                    AcquireSRWLockExclusive(&m_Lk);
+                    --m_cOpened;
+                    ReleaseSRWLockExclusive(&m_Lk);
+                    WakeConditionVariable(&m_cv);
+                    pSqlite = nullptr;
+                }
+                else
+                    DbpGetStmtCache(pSqlite)->OnLease();
+                return r;
+            }
+            const auto tNow = GetTickCount64();
+            if (!tStart)
+            {
+                tStart = tNow;
+                ++m_cWait;
+            }
+            if (tNow - tStart >= DbLeaseTimeout)
+            {
+                ++m_cTimeout;
+                m_msWait += (tNow - tStart);
+                ReleaseSRWLockExclusive(&m_Lk);
+                LOGE << "Lease database connection timed out, "
+                    << m_cOpened << " connections in use";
+                return SQLITE_BUSY;
+            }
+            ++m_cWaiting;
+            SleepConditionVariableSRW(&m_cv, &m_Lk,
+                DWORD(DbLeaseTimeout - (tNow - tStart)), 0);
+            --m_cWaiting;
+        }
+        if (tStart)
+            m_msWait += (GetTickCount64() - tStart);
+        ReleaseSRWLockExclusive(&m_Lk);
+        DbpGetStmtCache(pSqlite)->OnLease();
+        return SQLITE_OK;
+    }
+
+    void Return(sqlite3* pSqlite) noexcept
+    {
+        DbpGetStmtCache(pSqlite)->OnReturn();
+        AcquireSRWLockExclusive(&m_Lk);
+        m_vFree.emplace_back(pSqlite);
+        ReleaseSRWLockExclusive(&m_Lk);
+        WakeConditionVariable(&m_cv);
+    }
+
+    // 预先打开连接并加载模式，使首批请求无需等待打开
+    int Warmup(size_t cConn) noexcept
+    {
+        std::vector<sqlite3*> vConn{};
+        int r{ SQLITE_OK };
+        cConn = std::min(cConn, DbMaxConnection);
+        for (size_t i{}; i < cConn; ++i)
+        {
+            sqlite3* pSqlite;
+            r = Lease(pSqlite);
+            if (r != SQLITE_OK)
+                break;
+            vConn.emplace_back(pSqlite);
+            r = sqlite3_exec(pSqlite, "SELECT 1 FROM sqlite_schema LIMIT 1;",
+                nullptr, nullptr, nullptr);
+            if (r != SQLITE_OK)
+                break;
+        }
+        for (const auto p : vConn)
+            Return(p);
+        return r;
+    }
+
+    void GetStats(_Out_ DB_POOL_STATS& Stats) noexcept
+    {
+        AcquireSRWLockShared(&m_Lk);
+        Stats.cOpened = m_cOpened;
+        Stats.cIdle = m_vFree.size();
+        Stats.cWaiting = m_cWaiting;
+        Stats.cLease = m_cLease;
+        Stats.cWait = m_cWait;
+        Stats.cTimeout = m_cTimeout;
+        Stats.msWait = m_msWait;
+        ReleaseSRWLockShared(&m_Lk);
     }
+
+    // 关闭空闲连接，调用时不应有借出的连接
+    void Cleanup() noexcept
+    {
+        AcquireSRWLockExclusive(&m_Lk);
+        for (const auto p : m_vFree)
+            DbpClose(p);
+        m_cOpened -= m_vFree.size();
+        m_vFree.clear();
+        ReleaseSRWLockExclusive(&m_Lk);
+    }
+};
+
+// 触发器中取得当前操作者，未设置时返回DbIdInvalid
+static void DbpFnCurrentUser(sqlite3_context* pCtx, int, sqlite3_value**) noexcept
+{
+    sqlite3_result_int(pCtx, *(int*)sqlite3_user_data(pCtx));
+}
+
+static int DbpRegisterCurrentUser(sqlite3* pSqlite) noexcept
+{
+    const auto piUser = new int{ DbIdInvalid };
+    const int r = sqlite3_create_function_v2(pSqlite, "tkk_current_user", 0,
+        SQLITE_UTF8 | SQLITE_INNOCUOUS, piUser, DbpFnCurrentUser, nullptr, nullptr,
+        [](void* p) { delete (int*)p; });
+    // 失败时sqlite已调用析构函数
+    if (r == SQLITE_OK)
+        sqlite3_set_clientdata(pSqlite, DbCurrentUserName, piUser, nullptr);
     return r;
 }
 
+// 连接上只注册函数，不执行DDL，表结构由DbInitializeTable在启动时迁移
 static int DbpOpen(_Out_ sqlite3*& pSqlite) noexcept
 {
     int r = sqlite3_open16(s_DbFilePath.Data(), &pSqlite);
@@ -378,36 +1032,104 @@ static int DbpOpen(_Out_ sqlite3*& pSqlite) noexcept
     else
     {
         sqlite3_busy_timeout(pSqlite, 6000);
-        r = DbpTriggerCreateTask(pSqlite);
+        r = StRegisterFtsTokenizer(pSqlite);
+        if (r == SQLITE_OK)
+            r = DbpRegisterCurrentUser(pSqlite);
+        if (r != SQLITE_OK)
+            LOGE << "Sqlite error: " << r << "(" << sqlite3_errmsg(pSqlite) << ")";
     }
+    if (r != SQLITE_OK)
+        DbpCloseFailed(pSqlite);
     return r;
 }
+static CDbPool s_DbPool{ DbpOpen };
+
 int DbOpenFirst(std::wstring_view svFile, _Out_ sqlite3*& pSqlite) noexcept
 {
     EckAssert(s_DbFilePath.IsEmpty());
     s_DbFilePath = svFile;
-    return DbpOpen(pSqlite);
+    return s_DbPool.Lease(pSqlite);
 }
 int DbOpen(_Out_ sqlite3*& pSqlite) noexcept
 {
+    return s_DbPool.Lease(pSqlite);
+}
+void DbClose(sqlite3* pSqlite) noexcept
+{
+    DbSetCurrentUser(pSqlite, DbIdInvalid);
+    s_DbPool.Return(pSqlite);
+}
+
+void DbSetCurrentUser(sqlite3* pSqlite, int iUserId) noexcept
+{
+    const auto piUser = (int*)sqlite3_get_clientdata(pSqlite, DbCurrentUserName);
+    if (piUser)
+        *piUser = iUserId;
+}
+
+// 迁移在事务中执行，成功后将user_version置为其序号（从1开始）
+// 已发布的迁移不得修改，表结构与索引的变更均追加新的迁移
+using FDbMigration = int(*)(sqlite3* pSqlite) noexcept;
+
+static int DbpMigrate(sqlite3* pSqlite, std::span<const FDbMigration> Migration) noexcept
+{
+    sqlite3_stmt* pStmt;
+    int r = sqlite3_prepare_v3(pSqlite, EckStrAndLen("PRAGMA user_version"),
+        0, &pStmt, nullptr);
+    if (r != SQLITE_OK)
     {
-        eck::CSrwWriteGuard _{ s_DbConnLock };
-        if (!s_DbFreeConn.empty())
+        LOGE << "Sqlite error: " << r << "(" << sqlite3_errmsg(pSqlite) << ")";
+        return r;
+    }
+    int iVer{};
+    if ((r = sqlite3_step(pStmt)) == SQLITE_ROW)
+        iVer = sqlite3_column_int(pStmt, 0);
+    sqlite3_finalize(pStmt);
+    if (r != SQLITE_ROW)
+    {
+        LOGE << "Sqlite error: " << r << "(" << sqlite3_errmsg(pSqlite) << ")";
+        return r;
+    }
+    // 数据库由更新的版本创建
+    if (iVer < 0 || (size_t)iVer > Migration.size())
+    {
+        LOGE << "Unsupported schema version: " << iVer;
+        return SQLITE_MISMATCH;
+    }
+
+    char szSql[64];
+    for (size_t i = (size_t)iVer; i < Migration.size(); ++i)
+    {
+        r = sqlite3_exec(pSqlite, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr);
+        if (r != SQLITE_OK)
+        {
+            LOGE << "Sqlite error: " << r << "(" << sqlite3_errmsg(pSqlite) << ")";
+            return r;
+        }
+        r = Migration[i](pSqlite);
+        if (r == SQLITE_OK)
         {
-            pSqlite = s_DbFreeConn.back();
-            s_DbFreeConn.pop_back();
-            return SQLITE_OK;
+            // PRAGMA不支持参数绑定
+            sprintf_s(szSql, "PRAGMA user_version = %zu;", i + 1);
+            r = sqlite3_exec(pSqlite, szSql, nullptr, nullptr, nullptr);
+            if (r == SQLITE_OK)
+                r = sqlite3_exec(pSqlite, "COMMIT;", nullptr, nullptr, nullptr);
         }
+        if (r != SQLITE_OK)
+        {
+            LOGE << "Schema migration to version " << i + 1 << " failed: " << r
+                << "(" << sqlite3_errmsg(pSqlite) << ")";
+            sqlite3_exec(pSqlite, "ROLLBACK;", nullptr, nullptr, nullptr);
+            return r;
+        }
+        LOGI << "Schema migrated to version " << i + 1;
     }
-    return DbpOpen(pSqlite);
-}
-void DbClose(sqlite3* pSqlite) noexcept
-{
-    eck::CSrwWriteGuard _{ s_DbConnLock };
-    s_DbFreeConn.emplace_back(pSqlite);
+    return SQLITE_OK;
 }
 
-int DbInitializeTable(sqlite3* pSqlite) noexcept
+// 版本1，引入版本号前的全部表结构
+// 语句均可重复执行，引入版本号前创建的库也由此迁移补齐
+static int DbpMigrateBaseline(sqlite3* pSqlite) noexcept
 {
     int r;
     r = DbpTableCreateUser(pSqlite);
@@ -426,34 +1148,46 @@ int DbInitializeTable(sqlite3* pSqlite) noexcept
     if (r != SQLITE_OK) return r;
     r = DbpTableCreateTaskComment(pSqlite);
     if (r != SQLITE_OK) return r;
-    r = DbpViewCreateCoreEntity(pSqlite);
+    r = DbpTableCreateEntity(pSqlite);
+    if (r != SQLITE_OK) return r;
+    r = DbpTableCreateEntityFts(pSqlite);
+    if (r != SQLITE_OK) return r;
+    r = DbpTableCreateContentFts(pSqlite);
+    if (r != SQLITE_OK) return r;
+    r = DbpTriggerCreateTask(pSqlite);
     return r;
 }
 
-int DbIncrementId(sqlite3* pSqlite) noexcept
+constexpr static FDbMigration DbMigration[]
 {
-    char* pszErrMsg{};
-    const int r = sqlite3_exec(pSqlite,
-        R"(UPDATE GlobalId SET id = id + 1;)",
-        nullptr, nullptr, &pszErrMsg);
-    if (r != SQLITE_OK)
-    {
-        LOGE << "Sqlite error: " << r << "(" << pszErrMsg << ")";
-        sqlite3_free(pszErrMsg);
-    }
-    return r;
+    DbpMigrateBaseline,
+};
+
+int DbInitializeTable(sqlite3* pSqlite) noexcept
+{
+    return DbpMigrate(pSqlite, DbMigration);
 }
 
-void DbCleanup() noexcept
+int DbContentFtsSetPage(sqlite3* pSqlite, int iPageId, std::string_view svBody) noexcept
 {
-    eck::CSrwWriteGuard _{ s_DbConnLock };
-    for (auto p : s_DbFreeConn)
-        sqlite3_close(p);
-    for (auto p : s_DbPvFreeConn)
-        sqlite3_close(p);
-    s_DbFreeConn.clear();
+    return DbpContentFtsInsertPage(pSqlite, iPageId, svBody);
 }
 
+int DbIncrementId(sqlite3* pSqlite) noexcept
+{
+    sqlite3_stmt* pStmt;
+    int r = DbPrepare(pSqlite, TKK_DB_SQL(R"(UPDATE GlobalId SET id = id + 1;)"), pStmt);
+    if (r == SQLITE_OK)
+    {
+        r = sqlite3_step(pStmt);
+        DbFinalize(pStmt);
+        if (r == SQLITE_DONE)
+            r = SQLITE_OK;
+    }
+    if (r != SQLITE_OK)
+        LOGE << "Sqlite error: " << r << "(" << sqlite3_errmsg(pSqlite) << ")";
+    return r;
+}
 
 static int DbpPvCreateTablePageVersion(sqlite3* pSqlite) noexcept
 {
@@ -469,6 +1203,8 @@ CREATE TABLE IF NOT EXISTS PageVersion (
     edit_count      INTEGER     NOT NULL,
     description     TEXT        DEFAULT NULL
 );
+
+CREATE INDEX IF NOT EXISTS IdxPageVersion_PageVerId ON PageVersion(page_id, ver_id);
 )";
     char* pszErrMsg{};
     const int r = sqlite3_exec(pSqlite, Sql, nullptr, nullptr, &pszErrMsg);
@@ -480,44 +1216,114 @@ CREATE TABLE IF NOT EXISTS PageVersion (
     return r;
 }
 
-int DbPvOpenFirst(std::wstring_view svFile, _Out_ sqlite3*& pSqlite) noexcept
+static int DbpPvOpen(_Out_ sqlite3*& pSqlite) noexcept
 {
-    EckAssert(s_DbPvFilePath.IsEmpty());
-    s_DbPvFilePath = svFile;
-    const int r = sqlite3_open16(svFile.data(), &pSqlite);
+    const int r = sqlite3_open16(s_DbPvFilePath.Data(), &pSqlite);
     if (r != SQLITE_OK)
+    {
         LOGE << "Sqlite open failed: " << r;
+        DbpCloseFailed(pSqlite);
+    }
     else
         sqlite3_busy_timeout(pSqlite, 6000);
     return r;
 }
 
+static CDbPool s_DbPvPool{ DbpPvOpen };
+
+int DbPvOpenFirst(std::wstring_view svFile, _Out_ sqlite3*& pSqlite) noexcept
+{
+    EckAssert(s_DbPvFilePath.IsEmpty());
+    s_DbPvFilePath = svFile;
+    return s_DbPvPool.Lease(pSqlite);
+}
+
 int DbPvOpen(_Out_ sqlite3*& pSqlite) noexcept
 {
+    return s_DbPvPool.Lease(pSqlite);
+}
+
+void DbPvClose(sqlite3* pSqlite) noexcept
+{
+    s_DbPvPool.Return(pSqlite);
+}
+
+constexpr static FDbMigration DbPvMigration[]
+{
+    DbpPvCreateTablePageVersion,
+};
+
+int DbPvInitializeTable(sqlite3* pSqlite) noexcept
+{
+    return DbpMigrate(pSqlite, DbPvMigration);
+}
+
+// 打开内存库，与连接池中的连接注册相同的分词器与函数，并执行全部迁移
+static int DbpOpenCheckDb(BOOL bPageDb, _Out_ sqlite3*& pSqlite) noexcept
+{
+    int r = sqlite3_open(":memory:", &pSqlite);
+    if (r == SQLITE_OK)
+    {
+        DbpGetStmtCache(pSqlite)->OnLease();
+        r = StRegisterFtsTokenizer(pSqlite);
+        if (r == SQLITE_OK)
+            r = DbpRegisterCurrentUser(pSqlite);
+        if (r == SQLITE_OK)
+            r = (bPageDb ?
+                DbpMigrate(pSqlite, DbPvMigration) :
+                DbpMigrate(pSqlite, DbMigration));
+        if (r == SQLITE_OK)
+            return r;
+        DbpGetStmtCache(pSqlite)->OnReturn();
+    }
+    LOGE << "Open check database failed: " << r;
+    DbpCloseFailed(pSqlite);
+    return r;
+}
+
+int DbCheckQueryPlanInMemory() noexcept
+{
+    int r{ SQLITE_OK };
+    for (const auto bPageDb : { FALSE, TRUE })
     {
-        eck::CSrwWriteGuard _{ s_DbConnLock };
-        if (!s_DbPvFreeConn.empty())
+        sqlite3* pSqlite;
+        int r1 = DbpOpenCheckDb(bPageDb, pSqlite);
+        if (r1 == SQLITE_OK)
         {
-            pSqlite = s_DbPvFreeConn.back();
-            s_DbPvFreeConn.pop_back();
-            return SQLITE_OK;
+            r1 = DbpCheckQueryPlan(pSqlite, bPageDb);
+            DbpGetStmtCache(pSqlite)->OnReturn();
+            DbpClose(pSqlite);
         }
+        if (r1 != SQLITE_OK)
+            r = r1;
     }
-    const int r = sqlite3_open16(s_DbPvFilePath.Data(), &pSqlite);
-    if (r != SQLITE_OK)
-        LOGE << "Sqlite open failed: " << r;
-    else
-        sqlite3_busy_timeout(pSqlite, 6000);
     return r;
 }
 
-void DbPvClose(sqlite3* pSqlite) noexcept
+int DbWarmup(size_t cConn) noexcept
 {
-    eck::CSrwWriteGuard _{ s_DbConnLock };
-    s_DbPvFreeConn.emplace_back(pSqlite);
+    const auto r = s_DbPool.Warmup(cConn);
+    if (r != SQLITE_OK)
+        return r;
+    return s_DbPvPool.Warmup(cConn);
 }
 
-int DbPvInitializeTable(sqlite3* pSqlite) noexcept
+void DbGetPoolStats(BOOL bPageDb, _Out_ DB_POOL_STATS& Stats) noexcept
 {
-    return DbpPvCreateTablePageVersion(pSqlite);
+    (bPageDb ? s_DbPvPool : s_DbPool).GetStats(Stats);
+}
+
+void DbCleanup() noexcept
+{
+    DB_POOL_STATS Stats;
+    for (const auto bPageDb : { FALSE, TRUE })
+    {
+        DbGetPoolStats(bPageDb, Stats);
+        LOGI << (bPageDb ? "Page" : "Main") << " database pool: opened "
+            << Stats.cOpened << ", leases " << Stats.cLease << ", waits "
+            << Stats.cWait << ", timeouts " << Stats.cTimeout
+            << ", wait time " << Stats.msWait << "ms";
+    }
+    s_DbPool.Cleanup();
+    s_DbPvPool.Cleanup();
 }
\ No newline at end of file
@@ -45,6 +45,15 @@ enum class DbCoreEntity
     Max
 };
 
+// 全文索引中正文的来源
+enum class DbContentKind
+{
+    Page,           // 页面当前版本的正文
+    TaskDescription,
+    TaskComment,
+    Max
+};
+
 // 实体权限掩码，用于下列类型：
 // PageGroup/Project/Page/Task
 enum class DbAccess : UINT
@@ -79,14 +88,91 @@ ECK_ENUM_BIT_FLAGS(DbAccess);
 #define TKK_DBAC_ADMIN      "1"
 #define TKK_DBAC_FULLCTRL   "1"
 
+struct DB_POOL_STATS
+{
+    size_t cOpened;     // 已打开的连接数，含借出的
+    size_t cIdle;       // 空闲连接数
+    size_t cWaiting;    // 当前等待连接的请求数
+    ULONGLONG cLease;   // 累计借出次数
+    ULONGLONG cWait;    // 累计需要等待的借出次数
+    ULONGLONG cTimeout; // 累计等待超时次数
+    ULONGLONG msWait;   // 累计等待时间，毫秒
+};
+
+// DbOpen/DbPvOpen从连接池借出连接，连接数达到上限时等待，超时返回SQLITE_BUSY
+// DbClose/DbPvClose将连接归还连接池
+
 int DbOpenFirst(std::wstring_view svFile, _Out_ sqlite3*& pSqlite) noexcept;
 int DbOpen(_Out_ sqlite3*& pSqlite) noexcept;
 void DbClose(sqlite3* pSqlite) noexcept;
+// 执行尚未应用的表结构迁移，已是最新版本时不执行DDL
 int DbInitializeTable(sqlite3* pSqlite) noexcept;
+// 设置触发器记录的当前操作者，DbClose时复位
+// 操作者保存在连接上，仅应在独占借出的连接上设置，接口由ApiPreAction设置
+void DbSetCurrentUser(sqlite3* pSqlite, int iUserId) noexcept;
 int DbIncrementId(sqlite3* pSqlite) noexcept;
-void DbCleanup() noexcept;
+// 更新页面正文的全文索引，应与创建版本在同一事务中调用
+int DbContentFtsSetPage(sqlite3* pSqlite, int iPageId, std::string_view svBody) noexcept;
 
 int DbPvOpenFirst(std::wstring_view svFile, _Out_ sqlite3*& pSqlite) noexcept;
 int DbPvOpen(_Out_ sqlite3*& pSqlite) noexcept;
 void DbPvClose(sqlite3* pSqlite) noexcept;
-int DbPvInitializeTable(sqlite3* pSqlite) noexcept;
\ No newline at end of file
+int DbPvInitializeTable(sqlite3* pSqlite) noexcept;
+
+// 两个库各预先打开cConn个连接
+int DbWarmup(size_t cConn) noexcept;
+void DbGetPoolStats(BOOL bPageDb, _Out_ DB_POOL_STATS& Stats) noexcept;
+// 记录连接池统计并关闭所有空闲连接
+void DbCleanup() noexcept;
+
+// 从连接的语句缓存中取得预编译语句，必须使用DbFinalize归还
+// svSql必须为固定的语句文本，应以TKK_DB_SQL声明，动态拼接的语句应使用sqlite3_prepare_v3
+int DbPrepare(sqlite3* pSqlite, std::string_view svSql, _Out_ sqlite3_stmt*& pStmt) noexcept;
+// 归还DbPrepare取得的语句，缓存中的语句仅重置并清除绑定
+void DbFinalize(sqlite3_stmt* pStmt) noexcept;
+
+template<size_t N>
+EckInline int DbPrepare(sqlite3* pSqlite, const char(&Sql)[N],
+    _Out_ sqlite3_stmt*& pStmt) noexcept
+{
+    return DbPrepare(pSqlite, std::string_view{ Sql, N - 1 }, pStmt);
+}
+
+// 固定语句的文本，作为模板实参使每条语句在静态初始化时登记
+template<size_t N>
+struct DB_SQL_TEXT
+{
+    char sz[N];
+    consteval DB_SQL_TEXT(const char(&Sql)[N]) noexcept { std::copy_n(Sql, N, sz); }
+};
+struct DB_SQL_REG
+{
+    std::string_view svSql;
+    BOOL bPageDb;
+    const DB_SQL_REG* pNext;
+};
+// 仅由静态初始化调用
+BOOL DbRegisterSql(DB_SQL_REG& Reg) noexcept;
+
+template<DB_SQL_TEXT Text, BOOL bPageDb>
+struct DB_SQL
+{
+    static inline DB_SQL_REG Reg{ { Text.sz, sizeof(Text.sz) - 1 }, bPageDb };
+    static inline const BOOL bRegistered = DbRegisterSql(Reg);
+};
+// 取地址即ODR使用，使登记对象被实例化，函数本身不必执行
+template<DB_SQL_TEXT Text, BOOL bPageDb>
+EckInlineNdCe const auto& DbSql() noexcept
+{
+    (void)&DB_SQL<Text, bPageDb>::bRegistered;
+    return Text.sz;
+}
+// 声明主库/文章版本库的固定语句，结果为字符数组的引用，可直接传给DbPrepare
+// 登记的语句由DbCheckQueryPlanInMemory检查，动态拼接的语句不在检查范围内
+#define TKK_DB_SQL(...)     DbSql<__VA_ARGS__, FALSE>()
+#define TKK_DB_PV_SQL(...)  DbSql<__VA_ARGS__, TRUE>()
+
+// 在迁移后的内存库（两个库各一个，无统计信息）上检查全部登记语句的查询计划
+// 有未允许的全表扫描或无法编译的语句时返回SQLITE_ERROR，供--check-plans使用
+// 计划随SQLite版本与统计信息变化，不应作为服务启动的条件
+int DbCheckQueryPlanInMemory() noexcept;
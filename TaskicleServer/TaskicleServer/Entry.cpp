@@ -4,6 +4,8 @@
 
 #include "CServer.h"
 #include "Database.h"
+#include "ServerApi.h"
+#include "SearchTokenizer.h"
 
 #ifdef _DEBUG
 #  ifdef _WIN64
@@ -43,8 +45,25 @@ int wmain(int argc, WCHAR** argv)
     plog::init(plog::info, rsFileTemp.Data(), 65565, 100);
     plog::ColorConsoleAppender<plog::TxtFormatter> consoleAppender;
     plog::get()->addAppender(&consoleAppender);
+    // 检查登记语句的查询计划后退出，有全表扫描时返回非零，供CI使用
+    if (argc > 1 && wcscmp(argv[1], L"--check-plans") == 0)
+    {
+        const auto r = DbCheckQueryPlanInMemory();
+        eck::Uninitialize();
+        return r == SQLITE_OK ? 0 : 1;
+    }
+    // 检查分词结果并测量吞吐量后退出，检查失败时返回非零
+    if (argc > 1 && wcscmp(argv[1], L"--bench-tokenizer") == 0)
+    {
+        const auto bOk = StSelfTest(argc > 2 ? std::max(_wtoi(argv[2]), 1) : 10);
+        eck::Uninitialize();
+        return bOk ? 0 : 1;
+    }
     LOGI << "Server started.";
     // 读取配置
+    rsFileTemp.ReSize(cchRunningPath);
+    rsFileTemp.PushBack(EckStrAndLen(L"\\config.ini"));
+    ApiSetCompressLevel((int)GetPrivateProfileIntW(L"Server", L"GzipLevel", 6, rsFileTemp.Data()));
 
     // 初始化数据库
     EckAssert(sqlite3_threadsafe());
@@ -72,6 +91,9 @@ int wmain(int argc, WCHAR** argv)
         goto Exit;
     }
     DbPvClose(pSqlite);
+    // 预先打开连接
+    if (DbWarmup(4) != SQLITE_OK)
+        goto Exit;
     // 启动http服务器
     if (const auto r = CServer::Start(); r != SE_OK)
     {
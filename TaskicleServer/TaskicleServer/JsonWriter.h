@@ -0,0 +1,184 @@
+﻿#pragma once
+#include <emmintrin.h>
+
+// 流式JSON输出，直接追加到缓冲区，不构建文档树
+// 不检查结构是否合法，调用方须保证Begin/End成对、对象成员先写Key
+class CJsonWriter
+{
+private:
+    eck::CRefBin& m_rb;
+    BOOL m_bFirst{ TRUE };  // 当前容器尚无元素
+    BOOL m_bAfterKey{};     // 刚写入键，下一个值不加逗号
+
+    EckInline void Raw(std::string_view sv) noexcept
+    {
+        m_rb.PushBack(sv.data(), sv.size());
+    }
+    EckInline void RawChar(char ch) noexcept
+    {
+        m_rb.PushBackByte((BYTE)ch);
+    }
+
+    void BeforeValue() noexcept
+    {
+        if (m_bAfterKey)
+            m_bAfterKey = FALSE;
+        else if (!m_bFirst)
+            RawChar(',');
+        m_bFirst = FALSE;
+    }
+
+    // 返回sv中第一个需要转义的字符的位置，没有则返回sv.size()
+    static size_t FindEscape(std::string_view sv) noexcept
+    {
+        const auto p = sv.data();
+        size_t i = 0;
+        const auto vQuote = _mm_set1_epi8('"');
+        const auto vSlash = _mm_set1_epi8('\\');
+        const auto vCtrl = _mm_set1_epi8(0x1F);
+        for (; i + 16 <= sv.size(); i += 16)
+        {
+            const auto v = _mm_loadu_si128((const __m128i*)(p + i));
+            // 无符号比较v <= 0x1F
+            const auto vIsCtrl = _mm_cmpeq_epi8(_mm_max_epu8(v, vCtrl), vCtrl);
+            const auto vHit = _mm_or_si128(vIsCtrl, _mm_or_si128(
+                _mm_cmpeq_epi8(v, vQuote), _mm_cmpeq_epi8(v, vSlash)));
+            const auto uMask = (UINT)_mm_movemask_epi8(vHit);
+            if (uMask)
+                return i + std::countr_zero(uMask);
+        }
+        for (; i < sv.size(); ++i)
+        {
+            const auto ch = (BYTE)p[i];
+            if (ch <= 0x1F || ch == '"' || ch == '\\')
+                return i;
+        }
+        return sv.size();
+    }
+
+    void EscapeString(std::string_view sv) noexcept
+    {
+        constexpr char HexDigit[]{ "0123456789abcdef" };
+        RawChar('"');
+        for (;;)
+        {
+            const auto pos = FindEscape(sv);
+            if (pos)
+                Raw(sv.substr(0, pos));
+            if (pos == sv.size())
+                break;
+            const auto ch = (BYTE)sv[pos];
+            switch (ch)
+            {
+            case '"':  Raw(R"(\")"sv); break;
+            case '\\': Raw(R"(\\)"sv); break;
+            case '\n': Raw(R"(\n)"sv); break;
+            case '\r': Raw(R"(\r)"sv); break;
+            case '\t': Raw(R"(\t)"sv); break;
+            case '\b': Raw(R"(\b)"sv); break;
+            case '\f': Raw(R"(\f)"sv); break;
+            default:
+            {
+                const char Esc[]{ '\\', 'u', '0', '0',
+                    HexDigit[ch >> 4], HexDigit[ch & 0xF] };
+                Raw({ Esc, ARRAYSIZE(Esc) });
+            }
+            break;
+            }
+            sv.remove_prefix(pos + 1);
+        }
+        RawChar('"');
+    }
+public:
+    CJsonWriter(eck::CRefBin& rb) noexcept : m_rb{ rb } {}
+
+    CJsonWriter& BeginObject() noexcept
+    {
+        BeforeValue();
+        RawChar('{');
+        m_bFirst = TRUE;
+        return *this;
+    }
+    CJsonWriter& EndObject() noexcept
+    {
+        RawChar('}');
+        m_bFirst = FALSE;
+        return *this;
+    }
+    CJsonWriter& BeginArray() noexcept
+    {
+        BeforeValue();
+        RawChar('[');
+        m_bFirst = TRUE;
+        return *this;
+    }
+    CJsonWriter& EndArray() noexcept
+    {
+        RawChar(']');
+        m_bFirst = FALSE;
+        return *this;
+    }
+
+    // 键须为无需转义的常量
+    CJsonWriter& Key(std::string_view svKey) noexcept
+    {
+        EckAssert(FindEscape(svKey) == svKey.size());
+        if (!m_bFirst)
+            RawChar(',');
+        m_bFirst = FALSE;
+        RawChar('"');
+        Raw(svKey);
+        Raw("\":"sv);
+        m_bAfterKey = TRUE;
+        return *this;
+    }
+
+    CJsonWriter& Null() noexcept
+    {
+        BeforeValue();
+        Raw("null"sv);
+        return *this;
+    }
+    CJsonWriter& Bool(bool b) noexcept
+    {
+        BeforeValue();
+        Raw(b ? "true"sv : "false"sv);
+        return *this;
+    }
+    CJsonWriter& Int(LONGLONG i) noexcept
+    {
+        BeforeValue();
+        char Buf[24];
+        const auto Res = std::to_chars(Buf, Buf + ARRAYSIZE(Buf), i);
+        Raw({ Buf, size_t(Res.ptr - Buf) });
+        return *this;
+    }
+    CJsonWriter& String(std::string_view sv) noexcept
+    {
+        BeforeValue();
+        EscapeString(sv);
+        return *this;
+    }
+    // 空指针写入null
+    CJsonWriter& String(PCSTR psz) noexcept
+    {
+        if (!psz)
+            return Null();
+        return String(std::string_view{ psz });
+    }
+
+    template<class T>
+    CJsonWriter& Member(std::string_view svKey, T&& Val) noexcept
+    {
+        Key(svKey);
+        using TVal = std::remove_cvref_t<T>;
+        if constexpr (std::is_same_v<TVal, bool>)
+            return Bool(Val);
+        else if constexpr (std::is_enum_v<TVal>)
+            return Int((LONGLONG)Val);
+        else if constexpr (std::is_integral_v<TVal>)
+            return Int((LONGLONG)Val);
+        else
+            return String(Val);
+    }
+};
\ No newline at end of file
@@ -11,11 +11,41 @@ res\page
         s<ver_id>.txt   快照，指定版本id的全文内容
 */
 
-// 超出最大编辑次数时生成一个快照
-constexpr static int DiffMaxEditCount = 800;
+/*
+版本链
+    每个版本的diff是相对last_ver_id所指基准版本的SES，沿基准回溯到快照即可重建
+    采用跳跃增量：快照后第m个版本以第(m & (m - 1))个版本为基准，第0个即快照本身，
+    因此任意版本最多应用popcount(m)个补丁
+    是否生成快照取决于重建代价，即链上补丁个数与补丁总长
+*/
+
+// 重建一个版本最多应用的补丁个数，超出时生成快照
+constexpr static int DiffMaxChainLength = 10;
+// 链上补丁总长超出内容长度的此倍数时生成快照
+constexpr static size_t DiffSnapshotCostRatio = 2;
+// 补丁总长不超过此值时不因长度生成快照，避免小文章频繁快照
+constexpr static size_t DiffMinSnapshotCost = 64 * 1024;
+
+// 变更块的两侧长度之积超出此值时不再逐字节细化，直接整块删除后新增
+constexpr static size_t DiffMaxRefineProduct = 1024 * 1024;
+
+// 行级比较的单位，包含行尾的换行符
+struct DIFF_LINE
+{
+    PCBYTE p;
+    size_t cb;
+    size_t uHash;
+
+    // 散列相同时仍比较内容，散列冲突的行视为不同
+    bool operator==(const DIFF_LINE& x) const noexcept
+    {
+        return uHash == x.uHash && cb == x.cb && memcmp(p, x.p, cb) == 0;
+    }
+};
 
 // WARNING 不要使用除构造、compose、getSes之外的任何函数
 using TDtlDiff = dtl::Diff<BYTE, std::span<const BYTE>>;
+using TDtlLineDiff = dtl::Diff<DIFF_LINE, std::span<const DIFF_LINE>>;
 
 // 序列化的最短编辑距离(SES)结构
 // 以下述结构开头，后跟若干编辑动作
@@ -47,103 +77,400 @@ EckInlineNdCe DiffEdit DiffpDtlEditToDiffEdit(int i) noexcept
     return DiffEdit(i + 1);
 }
 
-// 序列化压缩SES，返回编辑次数
-static int DiffpSesSerialize(const TDtlDiff& Diff, eck::CRefBin& rb) noexcept
+// SES中的一个编辑动作
+struct DIFF_SES_OP
 {
-    rb.Clear();
-    const auto& Ses = Diff.getSes();
-    if (Ses.isOnlyCopy())
-        return 0;// 与上一版本比未编辑
-    const auto& vSeq = Ses.getSequence();
-
-    rb.Reserve(rb.Size() + sizeof(DIFF_SES_HDR) +
-        vSeq.size() * sizeof(BYTE));
-    const auto pHdr = rb.PushBack<DIFF_SES_HDR>();
-    pHdr->Magic = DiffHdrMagic_1;
+    DiffEdit eEdit;
+    USHORT Count;
+    PCBYTE pData;// 仅Add有效，指向新增序列
+};
 
-    size_t posCount{};
-    USHORT* pCount{};
-    DiffEdit eLastEdit{ DiffEdit::Invalid };
-    int cEdit{};
-    for (const auto& e : vSeq)
+// 顺序读取压缩SES
+class CDiffSesReader
+{
+private:
+    PCBYTE m_p{};
+    PCBYTE m_pEnd{};
+    BOOL m_bError{};
+public:
+    // 验证头，失败返回FALSE
+    BOOL Init(std::span<const BYTE> spSes) noexcept
     {
-        const auto eEdit = DiffpDtlEditToDiffEdit(e.second.type);
-        if (eEdit != eLastEdit)
+        m_bError = FALSE;
+        if (spSes.size() < sizeof(DIFF_SES_HDR) ||
+            ((DIFF_SES_HDR*)spSes.data())->Magic != DiffHdrMagic_1)
         {
-            eLastEdit = eEdit;
-            rb.PushBackByte((BYTE)eEdit);
-            posCount = rb.Size();
-            pCount = rb.PushBack<USHORT>();
-            *pCount = 0;
+            m_p = m_pEnd = nullptr;
+            return FALSE;
         }
+        m_p = spSes.data() + sizeof(DIFF_SES_HDR);
+        m_pEnd = spSes.data() + spSes.size();
+        return TRUE;
+    }
 
-#pragma warning(suppress:26813)// 使用按位与
-        if (eEdit == DiffEdit::Add)
+    // 到达结尾或格式错误时返回FALSE，使用IsError区分
+    BOOL Next(_Out_ DIFF_SES_OP& Op) noexcept
+    {
+        if (m_p >= m_pEnd)
+            return FALSE;
+        Op.eEdit = (DiffEdit)*m_p++;
+        if (Op.eEdit == DiffEdit::Invalid)// 终止标记
+        {
+            m_p = m_pEnd;
+            return FALSE;
+        }
+        if (Op.eEdit > DiffEdit::Add || m_p + sizeof(USHORT) > m_pEnd)
+        {
+            m_bError = TRUE;
+            return FALSE;
+        }
+        memcpy(&Op.Count, m_p, sizeof(USHORT));
+        m_p += sizeof(USHORT);
+        if (Op.eEdit == DiffEdit::Add)
         {
-            ++(*pCount);
-            rb.PushBackByte(e.first);
-            pCount = (USHORT*)(rb.Data() + posCount);
-            // 如果当前编辑操作长度超过USHORT最大值，另起一个
-            if (*pCount == 0xFFFF)
-                eLastEdit = DiffEdit::Invalid;
+            if (m_p + Op.Count > m_pEnd)
+            {
+                m_bError = TRUE;
+                return FALSE;
+            }
+            Op.pData = m_p;
+            m_p += Op.Count;
         }
         else
+            Op.pData = nullptr;
+        return TRUE;
+    }
+
+    EckInlineNdCe BOOL IsError() const noexcept { return m_bError; }
+};
+
+// 写入压缩SES，合并相邻的同类动作，超出USHORT最大值时另起一个
+class CDiffSesWriter
+{
+private:
+    eck::CRefBin& m_rb;
+    size_t m_posCount{};
+    DiffEdit m_eLast{ DiffEdit::Invalid };
+public:
+    CDiffSesWriter(eck::CRefBin& rb) noexcept : m_rb{ rb }
+    {
+        m_rb.Clear();
+        m_rb.PushBack<DIFF_SES_HDR>()->Magic = DiffHdrMagic_1;
+    }
+
+    void Emit(DiffEdit eEdit, size_t Count, PCBYTE pData = nullptr) noexcept
+    {
+        while (Count)
         {
-#pragma warning(suppress:6011)// 解引用NULL
-            if (++(*pCount) == 0xFFFF)
-                eLastEdit = DiffEdit::Invalid;
+            USHORT cCurr{};
+            if (eEdit == m_eLast)
+                memcpy(&cCurr, m_rb.Data() + m_posCount, sizeof(USHORT));
+            if (eEdit != m_eLast || cCurr == 0xFFFF)
+            {
+                m_eLast = eEdit;
+                m_rb.PushBackByte((BYTE)eEdit);
+                m_posCount = m_rb.Size();
+                m_rb.PushBack<USHORT>();
+                cCurr = 0;
+            }
+            const auto c = (USHORT)std::min(Count, size_t(0xFFFF - cCurr));
+            cCurr += c;
+            memcpy(m_rb.Data() + m_posCount, &cCurr, sizeof(USHORT));
+            if (eEdit == DiffEdit::Add)
+            {
+                m_rb.PushBack(pData, c);
+                pData += c;
+            }
+            Count -= c;
         }
+    }
 
+    void End() noexcept
+    {
+        m_rb.PushBackByte((BYTE)DiffEdit::Invalid);// 结束标记
+    }
+};
+
+// 将字节级SES写入压缩SES，返回编辑次数
+static int DiffpSesEmitDtl(const TDtlDiff& Diff, CDiffSesWriter& Writer) noexcept
+{
+    int cEdit{};
+    for (const auto& e : Diff.getSes().getSequence())
+    {
+        const auto eEdit = DiffpDtlEditToDiffEdit(e.second.type);
+        Writer.Emit(eEdit, 1, &e.first);
         if (eEdit != DiffEdit::Common)
             ++cEdit;
     }
-    rb.PushBackByte((BYTE)DiffEdit::Invalid);// 结束标记
+    return cEdit;
+}
+
+// 按行切分，最后一行可能不以换行符结尾
+static void DiffpSplitLine(
+    std::span<const BYTE> spContent,
+    std::vector<DIFF_LINE>& vLine) noexcept
+{
+    vLine.clear();
+    auto p = spContent.data();
+    const auto pEnd = p + spContent.size();
+    while (p < pEnd)
+    {
+        auto pNext = (PCBYTE)memchr(p, '\n', size_t(pEnd - p));
+        pNext = (pNext ? pNext + 1 : pEnd);
+        const auto cb = size_t(pNext - p);
+        vLine.emplace_back(DIFF_LINE{ p, cb,
+            std::hash<std::string_view>{}({ (PCCH)p, cb }) });
+        p = pNext;
+    }
+}
+
+// 逐字节细化一个变更块，返回编辑次数
+static int DiffpRefineHunk(
+    std::span<const BYTE> spDel,
+    std::span<const BYTE> spAdd,
+    CDiffSesWriter& Writer) noexcept
+{
+    // 行内修改通常只涉及一小段，先去除公共前后缀
+    const auto cbPrefix = dtl::commonPrefixBytes(spDel.data(), spAdd.data(),
+        std::min(spDel.size(), spAdd.size()));
+    spDel = spDel.subspan(cbPrefix);
+    spAdd = spAdd.subspan(cbPrefix);
+    const auto cbSuffix = dtl::commonSuffixBytes(
+        spDel.data() + spDel.size(), spAdd.data() + spAdd.size(),
+        std::min(spDel.size(), spAdd.size()));
+    spDel = spDel.first(spDel.size() - cbSuffix);
+    spAdd = spAdd.first(spAdd.size() - cbSuffix);
+
+    Writer.Emit(DiffEdit::Common, cbPrefix);
+    int cEdit;
+    if (spDel.empty() || spAdd.empty() ||
+        spDel.size() * spAdd.size() > DiffMaxRefineProduct)
+    {
+        Writer.Emit(DiffEdit::Delete, spDel.size());
+        Writer.Emit(DiffEdit::Add, spAdd.size(), spAdd.data());
+        cEdit = int(spDel.size() + spAdd.size());
+    }
+    else
+    {
+        TDtlDiff Diff{ spDel, spAdd };
+        Diff.compose();
+        cEdit = DiffpSesEmitDtl(Diff, Writer);
+    }
+    Writer.Emit(DiffEdit::Common, cbSuffix);
+    return cEdit;
+}
+
+// 生成将旧内容变为新内容的压缩SES，返回编辑次数，内容相同时SES不含编辑动作
+// 先按行比较，相邻的删除行与新增行组成变更块，仅对变更块逐字节细化
+static int DiffpMakeSes(
+    std::span<const BYTE> spLastContent,
+    std::span<const BYTE> spContent,
+    eck::CRefBin& rbSes) noexcept
+{
+    rbSes.Clear();
+    // 编辑通常集中在文档中部，先去除公共前后缀，并对齐到行首
+    const auto cbMin = std::min(spLastContent.size(), spContent.size());
+    auto cbPrefix = dtl::commonPrefixBytes(
+        spLastContent.data(), spContent.data(), cbMin);
+    while (cbPrefix && spContent[cbPrefix - 1] != '\n')
+        --cbPrefix;
+    auto cbSuffix = dtl::commonSuffixBytes(
+        spLastContent.data() + spLastContent.size(),
+        spContent.data() + spContent.size(), cbMin - cbPrefix);
+    const auto pSuffix = spContent.data() + spContent.size() - cbSuffix;
+    if (const auto pLf = cbSuffix ?
+        (PCBYTE)memchr(pSuffix, '\n', cbSuffix) : nullptr)
+        cbSuffix -= size_t(pLf + 1 - pSuffix);
+    else
+        cbSuffix = 0;
+    spLastContent = spLastContent.subspan(cbPrefix,
+        spLastContent.size() - cbPrefix - cbSuffix);
+    spContent = spContent.subspan(cbPrefix,
+        spContent.size() - cbPrefix - cbSuffix);
+
+    std::vector<DIFF_LINE> vLastLine{}, vLine{};
+    DiffpSplitLine(spLastContent, vLastLine);
+    DiffpSplitLine(spContent, vLine);
+    TDtlLineDiff Diff{ vLastLine, vLine };
+    Diff.compose();
+    const auto& Ses = Diff.getSes();
+    CDiffSesWriter Writer{ rbSes };
+    if (Ses.isOnlyCopy())
+    {
+        Writer.End();
+        return 0;// 内容相同
+    }
+    Writer.Emit(DiffEdit::Common, cbPrefix);
+    int cEdit{};
+    auto pLast = spLastContent.data();
+    auto pNew = spContent.data();
+    size_t cbDel{}, cbAdd{};
+    const auto FnFlushHunk = [&]
+        {
+            if (!cbDel && !cbAdd)
+                return;
+            cEdit += DiffpRefineHunk({ pLast, cbDel }, { pNew, cbAdd }, Writer);
+            pLast += cbDel;
+            pNew += cbAdd;
+            cbDel = cbAdd = 0;
+        };
+    for (const auto& e : Ses.getSequence())
+    {
+        switch (e.second.type)
+        {
+        case dtl::SES_DELETE:
+            cbDel += e.first.cb;
+            break;
+        case dtl::SES_ADD:
+            cbAdd += e.first.cb;
+            break;
+        default:
+            FnFlushHunk();
+            Writer.Emit(DiffEdit::Common, e.first.cb);
+            pLast += e.first.cb;
+            pNew += e.first.cb;
+            break;
+        }
+    }
+    FnFlushHunk();
+    // 公共后缀由应用SES时原样复制，无需写入
+    Writer.End();
     return cEdit;
 }
 
 // 给定原文，使用压缩SES编辑，得到修改后内容
-// 若格式验证错误，返回FALSE，格式验证仅对头执行，后续格式必须良好
+// 若格式验证错误，返回FALSE
+// 第一遍计算输出长度，第二遍从原文顺序复制到预分配的缓冲区
 static BOOL DiffpSesPatch(
-    const eck::CRefBin& rbLastContent,
-    const eck::CRefBin& rbSes,
+    std::span<const BYTE> spLastContent,
+    std::span<const BYTE> spSes,
     eck::CRefBin& rbNewContent) noexcept
 {
-    if (rbSes.Size() < sizeof(DIFF_SES_HDR))
+    CDiffSesReader Reader{};
+    if (!Reader.Init(spSes))
         return FALSE;
-    const auto pHdr = (DIFF_SES_HDR*)rbSes.Data();
-    if (pHdr->Magic != DiffHdrMagic_1)
+    DIFF_SES_OP Op;
+    size_t posLast{}, cbNew{};
+    while (Reader.Next(Op))
+    {
+        if (Op.eEdit != DiffEdit::Add)
+        {
+            posLast += Op.Count;
+            if (posLast > spLastContent.size())
+                return FALSE;
+        }
+        if (Op.eEdit != DiffEdit::Delete)
+            cbNew += Op.Count;
+    }
+    if (Reader.IsError())
         return FALSE;
-    rbNewContent = rbLastContent;
-    if (rbSes.Size() == sizeof(DIFF_SES_HDR))
-        return TRUE;// 空SES
-
-    size_t posLast{};
-    for (auto p = rbSes.Data() + sizeof(DIFF_SES_HDR); p < rbSes.Data() + rbSes.Size(); )
+    // SES未覆盖的部分保持不变
+    cbNew += (spLastContent.size() - posLast);
+
+    rbNewContent.ReSize(cbNew);
+    auto pDst = rbNewContent.Data();
+    auto pSrc = spLastContent.data();
+    Reader.Init(spSes);
+    while (Reader.Next(Op))
     {
-        const auto eEdit = (DiffEdit)*p++;
-        const auto Count = *(USHORT*)p;
-        p += sizeof(USHORT);
-        switch (eEdit)
+        switch (Op.eEdit)
         {
         case DiffEdit::Delete:
-            rbNewContent.Erase(posLast, Count);
+            pSrc += Op.Count;
             break;
         case DiffEdit::Common:
-            posLast += Count;
+            memcpy(pDst, pSrc, Op.Count);
+            pSrc += Op.Count;
+            pDst += Op.Count;
             break;
         case DiffEdit::Add:
-            rbNewContent.Insert(posLast, p, Count);
-            p += Count;
-            posLast += Count;
+            memcpy(pDst, Op.pData, Op.Count);
+            pDst += Op.Count;
             break;
-        case DiffEdit::Invalid:// 终止标记
-            return TRUE;
         default: ECK_UNREACHABLE;
         }
     }
+    const auto cbRest = size_t(spLastContent.data() + spLastContent.size() - pSrc);
+    if (cbRest)
+        memcpy(pDst, pSrc, cbRest);
     return TRUE;
 }
 
+// 重建版本缓存的总长上限
+constexpr static size_t DiffCacheMaxBytes = 64 * 1024 * 1024;
+// 超出此长度的版本不缓存
+constexpr static size_t DiffCacheMaxEntryBytes = 8 * 1024 * 1024;
+
+struct DIFF_CACHE_KEY
+{
+    int iPageId;
+    int iVerId;
+
+    bool operator==(const DIFF_CACHE_KEY&) const noexcept = default;
+};
+struct DIFF_CACHE_KEY_HASH
+{
+    size_t operator()(const DIFF_CACHE_KEY& k) const noexcept
+    {
+        return std::hash<ULONGLONG>{}(
+            ((ULONGLONG)(UINT)k.iPageId << 32) | (UINT)k.iVerId);
+    }
+};
+struct DIFF_CACHE_ENTRY
+{
+    DIFF_CACHE_KEY Key;
+    eck::CRefBin rbContent;
+};
+
+// 已重建版本的LRU缓存，按内容总长限制容量
+// 版本创建后内容不再改变，但写事务回滚后其插入的版本ID可能被复用，
+// 因此只缓存已提交的版本，写事务中只查找不写入
+class CDiffVersionCache
+{
+private:
+    eck::CSrwLock m_Lk{};
+    // 头部为最近使用
+    std::list<DIFF_CACHE_ENTRY> m_Lru{};
+    std::unordered_map<DIFF_CACHE_KEY,
+        std::list<DIFF_CACHE_ENTRY>::iterator, DIFF_CACHE_KEY_HASH> m_Map{};
+    size_t m_cbTotal{};
+public:
+    // 命中时复制内容，未命中返回FALSE
+    BOOL Lookup(const DIFF_CACHE_KEY& Key, eck::CRefBin& rbContent) noexcept
+    {
+        eck::CSrwWriteGuard _{ m_Lk };
+        const auto it = m_Map.find(Key);
+        if (it == m_Map.end())
+            return FALSE;
+        m_Lru.splice(m_Lru.begin(), m_Lru, it->second);
+        const auto& rb = it->second->rbContent;
+        rbContent.Assign(rb.Data(), rb.Size());
+        return TRUE;
+    }
+
+    void Insert(const DIFF_CACHE_KEY& Key, std::span<const BYTE> spContent) noexcept
+    {
+        if (spContent.size() > DiffCacheMaxEntryBytes)
+            return;
+        eck::CSrwWriteGuard _{ m_Lk };
+        if (m_Map.contains(Key))
+            return;
+        while (!m_Lru.empty() && m_cbTotal + spContent.size() > DiffCacheMaxBytes)
+        {
+            m_cbTotal -= m_Lru.back().rbContent.Size();
+            m_Map.erase(m_Lru.back().Key);
+            m_Lru.pop_back();
+        }
+        auto& e = m_Lru.emplace_front();
+        e.Key = Key;
+        e.rbContent.Assign(spContent.data(), spContent.size());
+        m_cbTotal += spContent.size();
+        m_Map.emplace(Key, m_Lru.begin());
+    }
+};
+
+static CDiffVersionCache s_DiffCache{};
+
 // 取指定版本的快照文件名
 // 返回文件名的视图，保证以0结尾
 static std::wstring_view DiffpMakeSnapshotFileName(
@@ -221,107 +548,223 @@ NTSTATUS DiffLoadFile(
     return STATUS_SUCCESS;
 }
 
-NTSTATUS DiffDbGetVersionContent(
+// bFillCache为FALSE时不写入缓存，供写事务使用
+static NTSTATUS DiffpDbGetVersionContent(
     _In_ sqlite3* pSqlite,
     CNtTransaction& TxFile,
     _In_ HANDLE hDirPage,
     int iPageId,
     int iVerId,
     eck::CRefBin& rbContent,
-    _Out_ int& rSql) noexcept
+    _Out_ int& rSql,
+    BOOL bFillCache) noexcept
 {
     rbContent.Clear();
+    if (s_DiffCache.Lookup({ iPageId, iVerId }, rbContent))
+        return STATUS_SUCCESS;
 
-    constexpr char Sql[]{ R"(
-SELECT last_ver_id, has_snapshot, diff FROM PageVersion 
-WHERE page_id = ? AND ver_id = ?
-)" };
+    // 沿last_ver_id回溯到最近的快照，版本ID沿链递增，
+    // 因此按ver_id降序即回溯顺序
+    constexpr auto& Sql = TKK_DB_PV_SQL(R"(
+WITH RECURSIVE Chain(ver_id, last_ver_id, has_snapshot) AS (
+    SELECT ver_id, last_ver_id, has_snapshot FROM PageVersion
+    WHERE page_id = ?1 AND ver_id = ?2
+UNION ALL
+    SELECT v.ver_id, v.last_ver_id, v.has_snapshot
+    FROM PageVersion AS v
+    JOIN Chain AS c ON v.ver_id = c.last_ver_id
+    WHERE c.has_snapshot = 0 AND v.page_id = ?1 AND v.ver_id < c.ver_id
+)
+SELECT ver_id, has_snapshot, diff FROM PageVersion
+WHERE ver_id IN (SELECT ver_id FROM Chain)
+ORDER BY ver_id DESC;
+)");
     sqlite3_stmt* pStmt;
-    rSql = sqlite3_prepare_v3(pSqlite, EckStrAndLen(Sql), 0, &pStmt, 0);
+    rSql = DbPrepare(pSqlite, Sql, pStmt);
     if (rSql != SQLITE_OK)
         return STATUS_UNSUCCESSFUL;
-    sqlite3_bind_int(pStmt, 2, iVerId);
     sqlite3_bind_int(pStmt, 1, iPageId);
+    sqlite3_bind_int(pStmt, 2, iVerId);
 
-    if ((rSql = sqlite3_step(pStmt)) == SQLITE_ROW)
+    // 回溯到快照或已缓存的祖先为止，记录途经的SES
+    std::vector<int> vVerId{};
+    std::vector<eck::CRefBin> vSes{};
+    NTSTATUS nts{ STATUS_NOT_FOUND };
+    while ((rSql = sqlite3_step(pStmt)) == SQLITE_ROW)
     {
-        rSql = SQLITE_OK;
-        const auto iLastVerId = sqlite3_column_int(pStmt, 0);
-        if (sqlite3_column_int(pStmt, 1))// 存在快照
+        const auto iCurrVerId = sqlite3_column_int(pStmt, 0);
+        if (iCurrVerId != iVerId &&
+            s_DiffCache.Lookup({ iPageId, iCurrVerId }, rbContent))
+        {
+            nts = STATUS_SUCCESS;
+            break;
+        }
+        if (sqlite3_column_int(pStmt, 1))
         {
-            sqlite3_finalize(pStmt);
             DIFF_SNAPSHOT_NAME Name;
-            return DiffLoadFile(
-                TxFile, hDirPage,
-                DiffpMakeSnapshotFileName(iVerId, Name),
+            nts = DiffLoadFile(TxFile, hDirPage,
+                DiffpMakeSnapshotFileName(iCurrVerId, Name),
                 rbContent);
+            if (NT_SUCCESS(nts) && bFillCache)
+                s_DiffCache.Insert({ iPageId, iCurrVerId }, rbContent.ToSpan());
+            break;
         }
-        eck::CRefBin rbSes{}, rbLastContent{};
-        rbSes.ReSize((size_t)sqlite3_column_bytes(pStmt, 2));
-        memcpy(rbSes.Data(), sqlite3_column_blob(pStmt, 2), rbSes.Size());
-        sqlite3_finalize(pStmt);
-
-        const auto nts = DiffDbGetVersionContent(pSqlite, TxFile, hDirPage,
-            iPageId, iLastVerId, rbLastContent, rSql);
-        if (!NT_SUCCESS(nts))
-            return nts;
-
-        if (!DiffpSesPatch(rbLastContent, rbSes, rbContent))
-            return NTSTATUS_FROM_WIN32(ERROR_BAD_FORMAT);
-        return STATUS_SUCCESS;
+        vVerId.emplace_back(iCurrVerId);
+        vSes.emplace_back().Assign((PCBYTE)sqlite3_column_blob(pStmt, 2),
+            (size_t)sqlite3_column_bytes(pStmt, 2));
     }
+    DbFinalize(pStmt);
+    if (rSql == SQLITE_DONE)
+    {
+        rSql = SQLITE_OK;
+        // 链上没有快照，版本链已损坏
+        if (!vVerId.empty())
+            nts = NTSTATUS_FROM_WIN32(ERROR_BAD_FORMAT);
+    }
+    else if (rSql == SQLITE_ROW)// 提前退出
+        rSql = SQLITE_OK;
     else
+        return STATUS_UNSUCCESSFUL;
+    if (!NT_SUCCESS(nts))
     {
-        sqlite3_finalize(pStmt);
-        return STATUS_NOT_FOUND;
+        rbContent.Clear();
+        return nts;
     }
+
+    // 从基准依次应用，途经的中间版本均写入缓存
+    eck::CRefBin rbNext{};
+    for (size_t i = vSes.size(); i; --i)
+    {
+        if (!DiffpSesPatch(rbContent.ToSpan(), vSes[i - 1].ToSpan(), rbNext))
+        {
+            rbContent.Clear();
+            return NTSTATUS_FROM_WIN32(ERROR_BAD_FORMAT);
+        }
+        std::swap(rbContent, rbNext);
+        if (bFillCache)
+            s_DiffCache.Insert({ iPageId, vVerId[i - 1] }, rbContent.ToSpan());
+    }
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS DiffDbGetVersionContent(
+    _In_ sqlite3* pSqlite,
+    CNtTransaction& TxFile,
+    _In_ HANDLE hDirPage,
+    int iPageId,
+    int iVerId,
+    eck::CRefBin& rbContent,
+    _Out_ int& rSql) noexcept
+{
+    return DiffpDbGetVersionContent(pSqlite, TxFile, hDirPage,
+        iPageId, iVerId, rbContent, rSql, TRUE);
 }
 
+// 新版本的增量基准
+struct DIFF_DELTA_BASE
+{
+    int iLatestVerId;   // 最新版本ID，无版本时为DbPvIdVersionLatest
+    int iBaseVerId;     // 基准版本ID
+    int cEdit;          // 从快照到基准版本的编辑次数
+    int cPatch;         // 重建基准版本需应用的补丁个数
+    size_t cbPatch;     // 重建基准版本需应用的补丁总长
+};
+
 /// <summary>
-/// 查询最新版本信息
+/// 按跳跃增量规则选取新版本的基准
 /// </summary>
 /// <param name="pSqlite">连接</param>
 /// <param name="iPageId">文章ID</param>
-/// <param name="iVerId">返回版本ID，失败返回DbIdInvalid，无版本返回DbPvIdVersionLatest</param>
-/// <param name="cEdit">返回从最近的快照到当前版本的编辑次数</param>
+/// <param name="Base">返回基准信息</param>
 /// <returns>sqlite错误码</returns>
-static int DiffpDbQueryLatestVersion(
+static int DiffpDbQueryDeltaBase(
     _In_ sqlite3* pSqlite,
     int iPageId,
-    _Out_ int& iVerId,
-    _Out_ int& cEdit) noexcept
+    _Out_ DIFF_DELTA_BASE& Base) noexcept
 {
-    constexpr char Sql[]{ R"(
-SELECT ver_id, edit_count FROM PageVersion
-WHERE page_id = ?
-ORDER BY ver_id DESC
-LIMIT 1
-)" };
-    cEdit = 0;
-
+    Base = { DbPvIdVersionLatest, DbIdInvalid };
+    // 最新版本、最近的快照及其后的版本数
+    constexpr auto& SqlSnapshot = TKK_DB_PV_SQL(R"(
+SELECT
+    (SELECT max(ver_id) FROM PageVersion WHERE page_id = ?1),
+    s.ver_id,
+    (SELECT count(*) FROM PageVersion WHERE page_id = ?1 AND ver_id > s.ver_id)
+FROM PageVersion AS s
+WHERE s.page_id = ?1 AND s.has_snapshot != 0
+ORDER BY s.ver_id DESC
+LIMIT 1;
+)");
     sqlite3_stmt* pStmt;
-    auto r = sqlite3_prepare_v3(pSqlite,
-        EckStrAndLen(Sql), 0, &pStmt, 0);
+    auto r = DbPrepare(pSqlite, SqlSnapshot, pStmt);
     if (r != SQLITE_OK)
-    {
-        iVerId = DbIdInvalid;
         return r;
-    }
     sqlite3_bind_int(pStmt, 1, iPageId);
+    r = sqlite3_step(pStmt);
+    if (r != SQLITE_ROW)
+    {
+        DbFinalize(pStmt);
+        return r == SQLITE_DONE ? SQLITE_OK : r;// 无版本
+    }
+    Base.iLatestVerId = sqlite3_column_int(pStmt, 0);
+    Base.iBaseVerId = sqlite3_column_int(pStmt, 1);
+    const auto m = (UINT)sqlite3_column_int(pStmt, 2) + 1;// 新版本在快照后的序号
+    DbFinalize(pStmt);
 
-    if ((r = sqlite3_step(pStmt)) == SQLITE_ROW)
+    const auto idxBase = m & (m - 1);
+    if (idxBase)
     {
-        iVerId = sqlite3_column_int(pStmt, 0);
-        cEdit = sqlite3_column_int(pStmt, 1);
-        sqlite3_finalize(pStmt);
-        return SQLITE_OK;
+        constexpr auto& SqlBase = TKK_DB_PV_SQL(R"(
+SELECT ver_id, edit_count FROM PageVersion
+WHERE page_id = ? AND ver_id > ?
+ORDER BY ver_id ASC
+LIMIT 1 OFFSET ?;
+)");
+        r = DbPrepare(pSqlite, SqlBase, pStmt);
+        if (r != SQLITE_OK)
+            return r;
+        sqlite3_bind_int(pStmt, 1, iPageId);
+        sqlite3_bind_int(pStmt, 2, Base.iBaseVerId);
+        sqlite3_bind_int(pStmt, 3, int(idxBase - 1));
+        r = sqlite3_step(pStmt);
+        if (r == SQLITE_ROW)
+        {
+            Base.iBaseVerId = sqlite3_column_int(pStmt, 0);
+            Base.cEdit = sqlite3_column_int(pStmt, 1);
+        }
+        DbFinalize(pStmt);
+        if (r != SQLITE_ROW)
+            return r == SQLITE_DONE ? SQLITE_CORRUPT : r;
     }
     else
+        return SQLITE_OK;// 以快照为基准
+
+    // 旧版本可能不是按跳跃增量创建的，按实际的链计算代价
+    constexpr auto& SqlCost = TKK_DB_PV_SQL(R"(
+WITH RECURSIVE Chain(ver_id, last_ver_id, has_snapshot, cb) AS (
+    SELECT ver_id, last_ver_id, has_snapshot, length(diff) FROM PageVersion
+    WHERE page_id = ?1 AND ver_id = ?2
+UNION ALL
+    SELECT v.ver_id, v.last_ver_id, v.has_snapshot, length(v.diff)
+    FROM PageVersion AS v
+    JOIN Chain AS c ON v.ver_id = c.last_ver_id
+    WHERE c.has_snapshot = 0 AND v.page_id = ?1 AND v.ver_id < c.ver_id
+)
+SELECT count(*), total(cb) FROM Chain WHERE has_snapshot = 0;
+)");
+    r = DbPrepare(pSqlite, SqlCost, pStmt);
+    if (r != SQLITE_OK)
+        return r;
+    sqlite3_bind_int(pStmt, 1, iPageId);
+    sqlite3_bind_int(pStmt, 2, Base.iBaseVerId);
+    r = sqlite3_step(pStmt);
+    if (r == SQLITE_ROW)
     {
-        iVerId = DbPvIdVersionLatest;
-        sqlite3_finalize(pStmt);
-        return SQLITE_OK;
+        Base.cPatch = sqlite3_column_int(pStmt, 0);
+        Base.cbPatch = (size_t)sqlite3_column_double(pStmt, 1);
+        r = SQLITE_OK;
     }
+    DbFinalize(pStmt);
+    return r;
 }
 
 NTSTATUS DiffDbCreateVersion(
@@ -335,63 +778,68 @@ NTSTATUS DiffDbCreateVersion(
 {
     NTSTATUS nts;
 
-    int iLastVerId;
-    int cEdit;
-    rSql = DiffpDbQueryLatestVersion(pSqlite, iPageId, iLastVerId, cEdit);
+    DIFF_DELTA_BASE Base;
+    rSql = DiffpDbQueryDeltaBase(pSqlite, iPageId, Base);
     if (rSql != SQLITE_OK)
         return STATUS_UNSUCCESSFUL;
 
-    const auto bNoVersion = (iLastVerId == DbPvIdVersionLatest);
-    eck::CRefBin rbLastContent{};
-    if (!bNoVersion)
-    {
-        nts = DiffLoadFile(TxFile, hDirPage, L"content.txt"sv, rbLastContent);
-        if (!NT_SUCCESS(nts))
-            return nts;
-    }
-
+    const auto bNoVersion = (Base.iLatestVerId == DbPvIdVersionLatest);
     BOOL bCreateSnapshot;
+    int cEdit{};
     eck::CRefBin rbSes{};
     if (bNoVersion)// 首次创建版本
         bCreateSnapshot = TRUE;
     else
     {
-        TDtlDiff Diff{ rbLastContent.ToSpan(), rbContent.ToSpan() };
-        Diff.compose();
-        const auto cNewEdit = DiffpSesSerialize(Diff, rbSes);
-        if (!cNewEdit)
-            return STATUS_ABANDONED;
-        cEdit += cNewEdit;
-        bCreateSnapshot = (cEdit > DiffMaxEditCount);
+        eck::CRefBin rbLastContent{};
+        nts = DiffLoadFile(TxFile, hDirPage, L"content.txt"sv, rbLastContent);
+        if (!NT_SUCCESS(nts))
+            return nts;
+        if (rbLastContent.Size() == rbContent.Size() &&
+            memcmp(rbLastContent.Data(), rbContent.Data(), rbContent.Size()) == 0)
+            return STATUS_ABANDONED;// 与上一版本比未编辑
+
+        // 基准为最新版本时直接使用当前内容
+        // 本事务可能回滚，重建的版本不写入缓存
+        if (Base.iBaseVerId != Base.iLatestVerId)
+        {
+            nts = DiffpDbGetVersionContent(pSqlite, TxFile, hDirPage,
+                iPageId, Base.iBaseVerId, rbLastContent, rSql, FALSE);
+            if (!NT_SUCCESS(nts))
+                return nts;
+        }
+        cEdit = Base.cEdit + DiffpMakeSes(
+            rbLastContent.ToSpan(), rbContent.ToSpan(), rbSes);
+
+        const auto cbPatch = Base.cbPatch + rbSes.Size();
+        bCreateSnapshot = (Base.cPatch + 1 > DiffMaxChainLength ||
+            cbPatch > std::max(rbContent.Size() * DiffSnapshotCostRatio,
+                DiffMinSnapshotCost));
+        if (bCreateSnapshot)
+            cEdit = 0;
     }
 
-    constexpr char Sql[]{ R"(
+    constexpr auto& Sql = TKK_DB_PV_SQL(R"(
 INSERT INTO PageVersion (page_id, user_id, last_ver_id, has_snapshot, diff, edit_count)
 VALUES (?, ?, ?, ?, ?, ?);
-)" };
+)");
     sqlite3_stmt* pStmt;
-    rSql = sqlite3_prepare_v3(pSqlite,
-        EckStrAndLen(Sql), 0, &pStmt, nullptr);
+    rSql = DbPrepare(pSqlite, Sql, pStmt);
     if (rSql != SQLITE_OK)
         return STATUS_UNSUCCESSFUL;
     sqlite3_bind_int(pStmt, 1, iPageId);
     sqlite3_bind_int(pStmt, 2, iUserId);
-    sqlite3_bind_int(pStmt, 3, iLastVerId);
+    sqlite3_bind_int(pStmt, 3, bNoVersion ? DbPvIdVersionLatest : Base.iBaseVerId);
     sqlite3_bind_int(pStmt, 4, bCreateSnapshot);
     if (bNoVersion)
-    {
         sqlite3_bind_null(pStmt, 5);
-        sqlite3_bind_int(pStmt, 6, 0);
-    }
     else
-    {
         sqlite3_bind_blob(pStmt, 5, rbSes.Data(),
             (int)rbSes.Size(), SQLITE_STATIC);
-        sqlite3_bind_int(pStmt, 6, cEdit);
-    }
+    sqlite3_bind_int(pStmt, 6, cEdit);
 
     rSql = sqlite3_step(pStmt);
-    sqlite3_finalize(pStmt);
+    DbFinalize(pStmt);
     if (rSql != SQLITE_DONE)
         return STATUS_UNSUCCESSFUL;
     rSql = SQLITE_OK;
@@ -39,7 +39,7 @@ NTSTATUS DiffDbCreateVersion(
     const eck::CRefBin& rbContent,
     _Out_ int& rSql) noexcept;
 
-// WARNING 必须在事务中调用
+// WARNING 必须在事务中调用，重建的版本将写入缓存，不能在可能回滚的写事务中调用
 // 版本ID不能为特殊ID，如DbPvIdVersionLatest
 NTSTATUS DiffDbGetVersionContent(
     _In_ sqlite3* pSqlite,
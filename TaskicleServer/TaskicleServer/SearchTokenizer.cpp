@@ -0,0 +1,386 @@
+﻿#include "pch.h"
+#include "SearchTokenizer.h"
+
+enum class StCharType : BYTE
+{
+    Separator,
+    Word,
+    Cjk,
+};
+
+constexpr static UINT StInvalidChar = UINT_MAX;
+
+// 解码一个UTF-8字符，非法序列返回StInvalidChar并消耗一个字节
+static UINT StpDecodeUtf8(PCSTR p, size_t cch, _Out_ int& cb) noexcept
+{
+    const auto b0 = (BYTE)p[0];
+    cb = 1;
+    if (b0 < 0x80)
+        return b0;
+    int cbSeq;
+    UINT ch;
+    if ((b0 & 0xE0) == 0xC0)
+        cbSeq = 2, ch = b0 & 0x1F;
+    else if ((b0 & 0xF0) == 0xE0)
+        cbSeq = 3, ch = b0 & 0x0F;
+    else if ((b0 & 0xF8) == 0xF0)
+        cbSeq = 4, ch = b0 & 0x07;
+    else
+        return StInvalidChar;
+    if ((size_t)cbSeq > cch)
+        return StInvalidChar;
+    for (int i = 1; i < cbSeq; ++i)
+    {
+        const auto b = (BYTE)p[i];
+        if ((b & 0xC0) != 0x80)
+            return StInvalidChar;
+        ch = (ch << 6) | (b & 0x3F);
+    }
+    // 拒绝超长编码与代理区
+    constexpr UINT MinChar[]{ 0, 0, 0x80, 0x800, 0x10000 };
+    if (ch < MinChar[cbSeq] || ch > 0x10FFFF || (ch >= 0xD800 && ch <= 0xDFFF))
+        return StInvalidChar;
+    cb = cbSeq;
+    return ch;
+}
+
+// 全角ASCII转为半角
+EckInlineNdCe UINT StpFoldWidth(UINT ch) noexcept
+{
+    return (ch >= 0xFF01 && ch <= 0xFF5E) ? ch - 0xFEE0 : ch;
+}
+
+static StCharType StpClassify(UINT ch) noexcept
+{
+    if (ch < 0x80)
+        return ((ch >= '0' && ch <= '9') || ((ch | 0x20) >= 'a' && (ch | 0x20) <= 'z')) ?
+            StCharType::Word : StCharType::Separator;
+    if ((ch >= 0x3040 && ch <= 0x30FF) ||   // 平假名、片假名
+        (ch >= 0x31F0 && ch <= 0x31FF) ||   // 片假名语音扩展
+        (ch >= 0x3400 && ch <= 0x4DBF) ||   // 扩展A
+        (ch >= 0x4E00 && ch <= 0x9FFF) ||   // 基本区
+        (ch >= 0xAC00 && ch <= 0xD7AF) ||   // 谚文音节
+        (ch >= 0xF900 && ch <= 0xFAFF) ||   // 兼容表意文字
+        (ch >= 0x20000 && ch <= 0x323AF))   // 扩展B及以后
+        return StCharType::Cjk;
+    if ((ch >= 0x80 && ch <= 0xBF) || ch == 0xD7 || ch == 0xF7 ||
+        (ch >= 0x2000 && ch <= 0x2BFF) ||   // 标点、符号、箭头、数学运算符等
+        (ch >= 0x2E00 && ch <= 0x2E7F) ||   // 补充标点
+        (ch >= 0x3000 && ch <= 0x303F) ||   // CJK标点
+        (ch >= 0xFE10 && ch <= 0xFE6F) ||   // 竖排与小型标点
+        (ch >= 0xFF00 && ch <= 0xFFEF) ||   // 全角ASCII已转换，余下均为标点与半角形式
+        (ch >= 0xFFF0 && ch <= 0xFFFF) ||
+        (ch >= 0x1F000 && ch <= 0x1FAFF) || // 表情与符号
+        ch == StInvalidChar)
+        return StCharType::Separator;
+    return StCharType::Word;
+}
+
+struct ST_CHAR
+{
+    UINT ch;
+    int cb;
+    StCharType eType;
+};
+
+static ST_CHAR StpNextChar(std::string_view svText, size_t pos) noexcept
+{
+    ST_CHAR c;
+    c.ch = StpFoldWidth(StpDecodeUtf8(svText.data() + pos, svText.size() - pos, c.cb));
+    c.eType = StpClassify(c.ch);
+    return c;
+}
+
+int StTokenize(std::string_view svText, StMode eMode,
+    FStToken pfnToken, void* pCtx) noexcept
+{
+    char Buf[StMaxTokenLength];
+    size_t pos = 0;
+    int r;
+    while (pos < svText.size())
+    {
+        auto c = StpNextChar(svText, pos);
+        switch (c.eType)
+        {
+        case StCharType::Separator:
+            pos += c.cb;
+            break;
+
+        case StCharType::Word:
+        {
+            const auto posStart = pos;
+            size_t cchBuf = 0;
+            do
+            {
+                // 仅折叠ASCII与Latin-1大写字母，其他字符保持原样
+                if (c.ch < 0x80)
+                {
+                    if (cchBuf < StMaxTokenLength)
+                        Buf[cchBuf++] = (char)((c.ch >= 'A' && c.ch <= 'Z') ? c.ch | 0x20 : c.ch);
+                }
+                else if (cchBuf + c.cb <= StMaxTokenLength)
+                {
+                    if (c.ch >= 0xC0 && c.ch <= 0xDE)
+                    {
+                        const auto chLower = c.ch | 0x20;
+                        Buf[cchBuf++] = char(0xC0 | (chLower >> 6));
+                        Buf[cchBuf++] = char(0x80 | (chLower & 0x3F));
+                    }
+                    else
+                    {
+                        memcpy(Buf + cchBuf, svText.data() + pos, c.cb);
+                        cchBuf += c.cb;
+                    }
+                }
+                pos += c.cb;
+                if (pos == svText.size())
+                    break;
+                c = StpNextChar(svText, pos);
+            } while (c.eType == StCharType::Word);
+            r = pfnToken(pCtx, { Buf, cchBuf }, (int)posStart, (int)pos, FALSE);
+            if (r != SQLITE_OK)
+                return r;
+        }
+        break;
+
+        case StCharType::Cjk:
+        {
+            auto posPrev = pos;
+            pos += c.cb;
+            BOOL bPair{};
+            while (pos < svText.size())
+            {
+                c = StpNextChar(svText, pos);
+                if (c.eType != StCharType::Cjk)
+                    break;
+                r = pfnToken(pCtx, svText.substr(posPrev, pos + c.cb - posPrev),
+                    (int)posPrev, int(pos + c.cb), FALSE);
+                if (r != SQLITE_OK)
+                    return r;
+                bPair = TRUE;
+                posPrev = pos;
+                pos += c.cb;
+            }
+            // 单字段落输出该字；文档中段落末字另以同位置单字输出，
+            // 以便"字"*这样的前缀查询能命中位于末尾的字
+            if (!bPair || eMode == StMode::Document)
+            {
+                r = pfnToken(pCtx, svText.substr(posPrev, pos - posPrev),
+                    (int)posPrev, (int)pos, bPair);
+                if (r != SQLITE_OK)
+                    return r;
+            }
+        }
+        break;
+        }
+    }
+    return SQLITE_OK;
+}
+
+// 分词器无参数也无状态，所有实例共用同一对象
+static int StpFtsCreate(void*, const char**, int, Fts5Tokenizer** ppOut) noexcept
+{
+    static char Dummy;
+    *ppOut = (Fts5Tokenizer*)&Dummy;
+    return SQLITE_OK;
+}
+
+static void StpFtsDelete(Fts5Tokenizer*) noexcept {}
+
+static int StpFtsTokenize(Fts5Tokenizer*, void* pCtx, int iFlags,
+    const char* pText, int cchText,
+    int (*pfnToken)(void*, int, const char*, int, int, int)) noexcept
+{
+    struct CTX
+    {
+        void* pCtx;
+        decltype(pfnToken) pfn;
+    } Ctx{ pCtx, pfnToken };
+    const auto eMode = ((iFlags & FTS5_TOKENIZE_QUERY) ?
+        StMode::Query : StMode::Document);
+    return StTokenize({ pText, (size_t)std::max(cchText, 0) }, eMode,
+        [](void* p, std::string_view svToken, int iStart, int iEnd, BOOL bColocated) noexcept
+        {
+            const auto& Ctx = *(CTX*)p;
+            return Ctx.pfn(Ctx.pCtx, bColocated ? FTS5_TOKEN_COLOCATED : 0,
+                svToken.data(), (int)svToken.size(), iStart, iEnd);
+        }, &Ctx);
+}
+
+int StRegisterFtsTokenizer(sqlite3* pSqlite) noexcept
+{
+    constexpr char Sql[]{ "SELECT fts5(?1)" };
+    sqlite3_stmt* pStmt;
+    auto r = sqlite3_prepare_v3(pSqlite, EckStrAndLen(Sql), 0, &pStmt, nullptr);
+    if (r != SQLITE_OK)
+    {
+        LOGE << "Sqlite error: " << r << "(" << sqlite3_errmsg(pSqlite) << ")";
+        return r;
+    }
+    fts5_api* pApi{};
+    sqlite3_bind_pointer(pStmt, 1, &pApi, "fts5_api_ptr", nullptr);
+    sqlite3_step(pStmt);
+    sqlite3_finalize(pStmt);
+    if (!pApi || pApi->iVersion < 2)
+    {
+        LOGE << "FTS5 is not available";
+        return SQLITE_ERROR;
+    }
+    fts5_tokenizer Tokenizer{ StpFtsCreate, StpFtsDelete, StpFtsTokenize };
+    r = pApi->xCreateTokenizer(pApi, StFtsTokenizerName, nullptr, &Tokenizer, nullptr);
+    if (r != SQLITE_OK)
+        LOGE << "Register FTS5 tokenizer failed: " << r;
+    return r;
+}
+
+
+// 以u8字面量书写期望结果，避免窄字符串受编译器执行字符集影响
+static std::string_view StpU8(std::u8string_view sv) noexcept
+{
+    return { (PCSTR)sv.data(), sv.size() };
+}
+
+// 词元以空格连接，与上一词元同位置的词元前加'+'
+static std::string StpJoinTokens(std::string_view svText, StMode eMode) noexcept
+{
+    std::string s{};
+    StTokenize(svText, eMode, [&](std::string_view svToken, int, int, BOOL bColocated) noexcept
+        {
+            if (!s.empty())
+                s.push_back(' ');
+            if (bColocated)
+                s.push_back('+');
+            s.append(svToken);
+            return SQLITE_OK;
+        });
+    return s;
+}
+
+static BOOL StpCheckTokens() noexcept
+{
+    struct CASE
+    {
+        std::u8string_view svText;
+        StMode eMode;
+        std::u8string_view svExpected;
+    };
+    constexpr CASE Case[]
+    {
+        { u8"Hello, 世界和平!"sv, StMode::Document, u8"hello 世界 界和 和平 +平"sv },
+        { u8"Hello, 世界和平!"sv, StMode::Query,    u8"hello 世界 界和 和平"sv },
+        { u8"Qt界面"sv,           StMode::Document, u8"qt 界面 +面"sv },
+        { u8"中"sv,               StMode::Query,    u8"中"sv },
+        { u8"ＡＢＣ１２３ Café"sv, StMode::Query,    u8"abc123 café"sv },
+        { u8"a\xFF\xFE" u8"b"sv,   StMode::Query,    u8"a b"sv },
+    };
+    BOOL bOk{ TRUE };
+    for (const auto& e : Case)
+    {
+        const auto s = StpJoinTokens(StpU8(e.svText), e.eMode);
+        if (s != StpU8(e.svExpected))
+        {
+            LOGE << "Tokenizer check failed: \"" << StpU8(e.svText) << "\" => \""
+                << s << "\", expected \"" << StpU8(e.svExpected) << "\"";
+            bOk = FALSE;
+        }
+    }
+    return bOk;
+}
+
+// 以文档模式建立倒排索引，以查询模式切分关键字后对各词元的文档取交集
+static BOOL StpCheckInvertedIndex() noexcept
+{
+    constexpr std::u8string_view Doc[]
+    {
+        u8"搜索引擎设计"sv,
+        u8"Qt界面开发"sv,
+        u8"Hello, 世界和平!"sv,
+    };
+    struct QUERY
+    {
+        std::u8string_view svKeyword;
+        int idxDoc;// -1表示无结果
+    };
+    constexpr QUERY Query[]
+    {
+        { u8"界面"sv,       1 },
+        { u8"引擎设"sv,     0 },
+        { u8"世界和平"sv,   2 },
+        { u8"HELLO"sv,      2 },
+        { u8"界面 hello"sv, -1 },
+        { u8"设计师"sv,     -1 },
+    };
+    std::unordered_map<std::string, std::vector<int>> Index{};
+    for (int i = 0; i < (int)ARRAYSIZE(Doc); ++i)
+        StTokenize(StpU8(Doc[i]), StMode::Document,
+            [&](std::string_view svToken, int, int, BOOL) noexcept
+            {
+                auto& v = Index[std::string{ svToken }];
+                if (v.empty() || v.back() != i)
+                    v.emplace_back(i);
+                return SQLITE_OK;
+            });
+
+    BOOL bOk{ TRUE };
+    for (const auto& e : Query)
+    {
+        std::vector<int> vHit{};
+        BOOL bFirst{ TRUE };
+        StTokenize(StpU8(e.svKeyword), StMode::Query,
+            [&](std::string_view svToken, int, int, BOOL) noexcept
+            {
+                const auto it = Index.find(std::string{ svToken });
+                if (it == Index.end())
+                    vHit.clear();
+                else if (bFirst)
+                    vHit = it->second;
+                else
+                    std::erase_if(vHit, [&](int i)
+                        { return std::find(it->second.begin(), it->second.end(), i) == it->second.end(); });
+                bFirst = FALSE;
+                return SQLITE_OK;
+            });
+        const auto bMatch = (e.idxDoc < 0 ? vHit.empty() :
+            (vHit.size() == 1 && vHit.front() == e.idxDoc));
+        if (!bMatch)
+        {
+            LOGE << "Inverted index check failed: \"" << StpU8(e.svKeyword)
+                << "\" hit " << vHit.size() << " document(s), expected " << e.idxDoc;
+            bOk = FALSE;
+        }
+    }
+    return bOk;
+}
+
+BOOL StSelfTest(int cRound) noexcept
+{
+    BOOL bOk = StpCheckTokens();
+    if (!StpCheckInvertedIndex())
+        bOk = FALSE;
+
+    // 中英混排语料，约4MB
+    constexpr auto svPara = u8"任务看板支持拖拽排序，Release 2.3 修复了 Markdown "
+        u8"渲染的问题。搜索框输入关键字后，服务器以 FTS5 bm25 排序返回结果；"
+        u8"全角ＡＢＣ与半角abc视为相同。Café naïve résumé 東京タワー 한국어 텍스트\n"sv;
+    std::string Corpus{};
+    while (Corpus.size() < 4 * 1024 * 1024)
+        Corpus.append(StpU8(svPara));
+
+    size_t cToken{};
+    const auto tStart = std::chrono::steady_clock::now();
+    for (int i = 0; i < cRound; ++i)
+        StTokenize(Corpus, StMode::Document, [&](std::string_view, int, int, BOOL) noexcept
+            {
+                ++cToken;
+                return SQLITE_OK;
+            });
+    const auto dSec = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - tStart).count();
+    const auto cbTotal = (double)Corpus.size() * cRound;
+    LOGI << "Tokenizer: " << cRound << " x " << Corpus.size() << " bytes, "
+        << cToken << " tokens in " << dSec * 1000. << " ms, "
+        << cbTotal / (1024. * 1024.) / dSec << " MB/s, "
+        << cToken / 1e6 / dSec << " M tokens/s";
+    LOGI << "Tokenizer self test " << (bOk ? "passed" : "failed");
+    return bOk;
+}
\ No newline at end of file
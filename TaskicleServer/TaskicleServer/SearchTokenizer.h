@@ -0,0 +1,39 @@
+﻿#pragma once
+
+// FTS5分词器名称，DbpOpen在每个连接上注册
+constexpr inline char StFtsTokenizerName[]{ "tkk_cjk" };
+// 词元最大字节数，过长的词截断
+constexpr inline size_t StMaxTokenLength = 128;
+
+enum class StMode : BYTE
+{
+    Document,   // 建立索引，CJK串末尾额外输出末字，使单字前缀查询能命中
+    Query,      // 查询串，词元须与文档中的相邻位置逐一对应
+};
+
+// 词元回调，iStart与iEnd为原文中的字节偏移，bColocated表示与上一个词元位于同一位置
+// 返回SQLITE_OK以外的值时停止分词，StTokenize返回该值
+using FStToken = int(*)(void* pCtx, std::string_view svToken,
+    int iStart, int iEnd, BOOL bColocated) noexcept;
+
+// 切分UTF-8文本：CJK连续段输出相邻二字组，字母数字连续段输出小写词
+// 全角ASCII按半角处理，标点、符号、空白与非法字节均作为分隔
+int StTokenize(std::string_view svText, StMode eMode,
+    FStToken pfnToken, void* pCtx) noexcept;
+
+template<class F>
+EckInline int StTokenize(std::string_view svText, StMode eMode, F&& Fn) noexcept
+{
+    return StTokenize(svText, eMode, [](void* pCtx, std::string_view svToken,
+        int iStart, int iEnd, BOOL bColocated) noexcept -> int
+        {
+            return (*(std::remove_reference_t<F>*)pCtx)(svToken, iStart, iEnd, bColocated);
+        }, (void*)std::addressof(Fn));
+}
+
+// 检查典型输入的二字组与单词输出及倒排索引查询结果，
+// 并对约4MB的中英混排语料分词cRound轮，吞吐量写入日志，检查全部通过时返回TRUE
+BOOL StSelfTest(int cRound = 10) noexcept;
+
+// 在连接上注册FTS5分词器，须在访问使用该分词器的表之前调用
+int StRegisterFtsTokenizer(sqlite3* pSqlite) noexcept;
\ No newline at end of file
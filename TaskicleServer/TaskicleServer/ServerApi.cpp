@@ -1,64 +1,237 @@
 ﻿#include "pch.h"
 #include "ServerApi.h"
 #include "ApiPriv.h"
+#include "Database.h"
+#include "AccessCheck.h"
+#include "SessionCache.h"
+#include "StaticRes.h"
 
 static void ApipDatabaseError(const API_CTX& Ctx, int r) noexcept
 {
     Ctx.pSender->SendResponse(Ctx.dwConnId,
         HSC_INTERNAL_SERVER_ERROR, "Internal Server Error");
-    LOGE << "OpenDatabase Failed: " << r <<
-        "(" << sqlite3_errmsg(Ctx.pExtra->pSqlite) << ")";
+    LOGE << "OpenDatabase Failed: " << r << "(" << sqlite3_errstr(r) << ")";
 }
-BOOL ApiPreAction(const API_CTX& Ctx) noexcept
+BOOL ApiPreAction(API_CTX& Ctx) noexcept
 {
-    auto r = Ctx.pExtra->OpenDatabase();
-    if (r != SQLITE_OK)
+    EckAssert((Ctx.eRes & ApiRes::Auth) == ApiRes::None ||
+        (Ctx.eRes & ApiRes::Db) != ApiRes::None);
+    int r;
+    if ((Ctx.eRes & ApiRes::Db) != ApiRes::None)
     {
-        ApipDatabaseError(Ctx, r);
-        return FALSE;
+        r = DbOpen(Ctx.pSqlite);
+        if (r != SQLITE_OK)
+        {
+            ApipDatabaseError(Ctx, r);
+            return FALSE;
+        }
     }
-    r = Ctx.pExtra->OpenPageDatabase();
-    if (r != SQLITE_OK)
+    if ((Ctx.eRes & ApiRes::PvDb) != ApiRes::None)
     {
-        ApipDatabaseError(Ctx, r);
-        return FALSE;
+        r = DbPvOpen(Ctx.pSqlitePv);
+        if (r != SQLITE_OK)
+        {
+            if (Ctx.pSqlite)
+            {
+                DbClose(Ctx.pSqlite);
+                Ctx.pSqlite = nullptr;
+            }
+            ApipDatabaseError(Ctx, r);
+            return FALSE;
+        }
+    }
+    if ((Ctx.eRes & ApiRes::Auth) != ApiRes::None)
+    {
+        CkDbResolveCurrentUser(Ctx);
+        // 连接由本请求独占，触发器在整个请求期间记录同一操作者
+        DbSetCurrentUser(Ctx.pSqlite, Ctx.iUserId);
     }
     return TRUE;
 }
 void ApiPostAction(const API_CTX& Ctx) noexcept
 {
+    // 回滚的事务留下的失效记录不应带入下一次借出
+    AclDbFlushInvalidation(Ctx);
+    if (Ctx.pSqlite)
+        DbClose(Ctx.pSqlite);
+    if (Ctx.pSqlitePv)
+        DbPvClose(Ctx.pSqlitePv);
     Ctx.pExtra->DecRef();
 }
 
-void ApiParseQueryString(const API_CTX& Ctx, std::vector<QUERY_KV>& vKv) noexcept
+static void ApipParseQueryString(API_REQUEST& Req, PCSTR pszQuery) noexcept
 {
-    const auto pszQuery = Ctx.pSender->GetUrlField(Ctx.dwConnId, HUF_QUERY);
-    if (!pszQuery || !*pszQuery)
-        return;
     std::string_view svQuery{ pszQuery };
-    size_t i = 0;
-    while (i < svQuery.size())
+    while (!svQuery.empty() && Req.cQuery < ApiMaxQueryKv)
     {
-        const auto posEq = svQuery.find('=', i);
-        const auto posAmp = svQuery.find('&', i);
-        if (posEq == std::string_view::npos ||
-            (posAmp != std::string_view::npos && posAmp < posEq))
-            break;
-        QUERY_KV kv{};
-        kv.K = svQuery.substr(i, posEq - i);
+        auto posAmp = svQuery.find('&');
         if (posAmp == std::string_view::npos)
+            posAmp = svQuery.size();
+        const auto svItem = svQuery.substr(0, posAmp);
+        const auto posEq = svItem.find('=');
+        if (posEq != std::string_view::npos)
         {
-            kv.V = svQuery.substr(posEq + 1);
-            vKv.emplace_back(kv);
-            break;
+            auto& kv = Req.Query[Req.cQuery++];
+            kv.K = svItem.substr(0, posEq);
+            kv.V = svItem.substr(posEq + 1);
         }
-        else
+        svQuery.remove_prefix(std::min(posAmp + 1, svQuery.size()));
+    }
+}
+
+static void ApipParseCookie(API_REQUEST& Req, std::string_view svCookie) noexcept
+{
+    while (!svCookie.empty())
+    {
+        auto posSemi = svCookie.find(';');
+        if (posSemi == std::string_view::npos)
+            posSemi = svCookie.size();
+        auto svItem = svCookie.substr(0, posSemi);
+        svCookie.remove_prefix(std::min(posSemi + 1, svCookie.size()));
+        while (!svItem.empty() && svItem.front() == ' ')
+            svItem.remove_prefix(1);
+        if (svItem.starts_with("sid="sv))
+        {
+            svItem.remove_prefix(4);
+            while (!svItem.empty() && svItem.back() == ' ')
+                svItem.remove_suffix(1);
+            if (svItem.size() == CkSidStrLen)
+                Req.svSid = svItem;
+            return;
+        }
+    }
+}
+
+BOOL ApiAcceptGzip(PCSTR pszAcceptEncoding) noexcept
+{
+    std::string_view sv{ pszAcceptEncoding };
+    while (!sv.empty())
+    {
+        auto posComma = sv.find(',');
+        auto svItem = sv.substr(0, posComma);
+        sv = (posComma == std::string_view::npos ? std::string_view{} : sv.substr(posComma + 1));
+
+        const auto posSemi = svItem.find(';');
+        auto svName = svItem.substr(0, posSemi);
+        while (!svName.empty() && svName.front() == ' ')
+            svName.remove_prefix(1);
+        while (!svName.empty() && svName.back() == ' ')
+            svName.remove_suffix(1);
+        if (!eck::TcsEqualLen2I(svName.data(), svName.size(), EckStrAndLen("gzip")) &&
+            !(svName.size() == 1 && svName.front() == '*'))
+            continue;
+        if (posSemi == std::string_view::npos)
+            return TRUE;
+        // q=0表示不接受
+        const auto svParam = svItem.substr(posSemi + 1);
+        const auto posQ = svParam.find("q=");
+        if (posQ == std::string_view::npos)
+            return TRUE;
+        for (const auto ch : svParam.substr(posQ + 2))
+        {
+            if (ch >= '1' && ch <= '9')
+                return TRUE;
+            if (ch != '0' && ch != '.')
+                break;
+        }
+        return FALSE;
+    }
+    return FALSE;
+}
+
+void ApiParseRequest(API_CTX& Ctx) noexcept
+{
+    const auto pszQuery = Ctx.pSender->GetUrlField(Ctx.dwConnId, HUF_QUERY);
+    if (pszQuery && *pszQuery)
+        ApipParseQueryString(Ctx.Req, pszQuery);
+    PCSTR pszCookie;
+    if (Ctx.pSender->GetHeader(Ctx.dwConnId, "Cookie", &pszCookie) && pszCookie)
+        ApipParseCookie(Ctx.Req, pszCookie);
+    PCSTR pszAcceptEncoding;
+    if (Ctx.pSender->GetHeader(Ctx.dwConnId, "Accept-Encoding", &pszAcceptEncoding) &&
+        pszAcceptEncoding)
+        Ctx.Req.bAcceptGzip = ApiAcceptGzip(pszAcceptEncoding);
+}
+
+static int ApipHexValue(char ch) noexcept
+{
+    if (ch >= '0' && ch <= '9')
+        return ch - '0';
+    if (ch >= 'a' && ch <= 'f')
+        return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'F')
+        return ch - 'A' + 10;
+    return -1;
+}
+
+BOOL ApiUrlDecode(std::string_view sv, std::span<char> Buf,
+    _Out_ std::string_view& svResult) noexcept
+{
+    if (sv.find('%') == std::string_view::npos)
+    {
+        svResult = sv;
+        return TRUE;
+    }
+    svResult = {};
+    size_t cch{};
+    for (size_t i = 0; i < sv.size(); ++i)
+    {
+        if (cch == Buf.size())
+            return FALSE;
+        if (sv[i] == '%')
         {
-            kv.V = svQuery.substr(posEq + 1, posAmp - posEq - 1);
-            vKv.emplace_back(kv);
-            i = posAmp + 1;
+            if (i + 2 >= sv.size())
+                return FALSE;
+            const auto Hi = ApipHexValue(sv[i + 1]);
+            const auto Lo = ApipHexValue(sv[i + 2]);
+            if (Hi < 0 || Lo < 0)
+                return FALSE;
+            Buf[cch++] = char((Hi << 4) | Lo);
+            i += 2;
         }
+        else
+            Buf[cch++] = sv[i];
+    }
+    svResult = { Buf.data(), cch };
+    return TRUE;
+}
+
+constexpr static size_t ApiCursorStrLen = 32;
+
+BOOL ApiParseCursor(std::string_view sv, _Out_ API_CURSOR& Cursor) noexcept
+{
+    Cursor = {};
+    if (sv.size() != ApiCursorStrLen)
+        return FALSE;
+    ULONGLONG k[2]{};
+    for (size_t i = 0; i < ApiCursorStrLen; ++i)
+    {
+        const auto ch = sv[i];
+        UINT u;
+        if (ch >= '0' && ch <= '9')
+            u = ch - '0';
+        else if (ch >= 'a' && ch <= 'f')
+            u = ch - 'a' + 10;
+        else
+            return FALSE;
+        k[i / 16] = (k[i / 16] << 4) | u;
     }
+    Cursor = { (LONGLONG)k[0], (LONGLONG)k[1] };
+    return TRUE;
+}
+
+void ApiWriteNextCursor(CJsonWriter& w, BOOL bMore, const API_CURSOR& Cursor) noexcept
+{
+    w.Key("next_cursor");
+    if (!bMore)
+    {
+        w.Null();
+        return;
+    }
+    char szCursor[ApiCursorStrLen + 1];
+    sprintf_s(szCursor, "%016llx%016llx",
+        (ULONGLONG)Cursor.k1, (ULONGLONG)Cursor.k2);
+    w.String(std::string_view{ szCursor, ApiCursorStrLen });
 }
 
 void ApiParseInt(std::string_view sv, _Inout_ int& i) noexcept
@@ -68,15 +241,131 @@ void ApiParseInt(std::string_view sv, _Inout_ int& i) noexcept
         i = j;
 }
 
+// 超过此大小的缓冲区在发送后释放，避免单次大响应长期占用线程内存
+constexpr static size_t ApiMaxRetainedJsonBuffer = 1024 * 1024;
+// 小于此大小的响应压缩收益不足以抵消开销
+constexpr static size_t ApiMinCompressSize = 1024;
+constexpr static size_t ApiMaxExtraHeader = 4;
+
+static std::atomic<int> s_iApiCompressLevel{ 6 };
+
+// 线程复用的压缩器，级别变化时重新初始化
+struct API_DEFLATE
+{
+    z_stream zs{};
+    int iLevel{};
+    BOOL bInit{};
+
+    ~API_DEFLATE()
+    {
+        if (bInit)
+            deflateEnd(&zs);
+    }
+};
+
+static thread_local eck::CRefBin t_rbJson{};
+static thread_local eck::CRefBin t_rbGzip{};
+static thread_local API_DEFLATE t_Deflate{};
+
+void ApiSetCompressLevel(int iLevel) noexcept
+{
+    s_iApiCompressLevel.store(std::clamp(iLevel, -1, 9), std::memory_order_relaxed);
+}
+
+static int ApipGzipCompress(std::span<const BYTE> sp, int iLevel, eck::CRefBin& rbOut) noexcept
+{
+    auto& Deflate = t_Deflate;
+    int r;
+    if (Deflate.bInit && Deflate.iLevel == iLevel)
+        r = deflateReset(&Deflate.zs);
+    else
+    {
+        if (Deflate.bInit)
+        {
+            deflateEnd(&Deflate.zs);
+            Deflate.bInit = FALSE;
+        }
+        Deflate.zs = {};
+        // windowBits加16以输出gzip格式
+        r = deflateInit2(&Deflate.zs, iLevel, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+        if (r == Z_OK)
+        {
+            Deflate.bInit = TRUE;
+            Deflate.iLevel = iLevel;
+        }
+    }
+    if (r != Z_OK)
+        return r;
+    auto& zs = Deflate.zs;
+    rbOut.ReSize(deflateBound(&zs, (uLong)sp.size()));
+    zs.next_in = (Bytef*)sp.data();
+    zs.avail_in = (uInt)sp.size();
+    zs.next_out = rbOut.Data();
+    zs.avail_out = (uInt)rbOut.Size();
+    r = deflate(&zs, Z_FINISH);
+    if (r != Z_STREAM_END)
+        return r == Z_OK ? Z_BUF_ERROR : r;
+    rbOut.ReSize(zs.total_out);
+    return Z_OK;
+}
+
+// 客户端接受且响应足够大时以gzip发送
+static void ApipSendJson(const API_CTX& Ctx, std::span<const BYTE> sp,
+    USHORT usStatusCode, const THeader* pHeader, size_t cHeader) noexcept
+{
+    EckAssert(cHeader <= ApiMaxExtraHeader);
+    // 多余的头部丢弃，避免越界
+    if (cHeader > ApiMaxExtraHeader)
+    {
+        LOGW << "Too many response headers: " << cHeader;
+        cHeader = ApiMaxExtraHeader;
+    }
+    THeader Header[ApiMaxExtraHeader + 3];
+    size_t c{};
+    for (; c < cHeader; ++c)
+        Header[c] = pHeader[c];
+    Header[c++] = { "Content-Type", "application/json; charset=utf-8" };
+    Header[c++] = { "Vary", "Accept-Encoding" };
+
+    const auto iLevel = s_iApiCompressLevel.load(std::memory_order_relaxed);
+    if (iLevel && Ctx.Req.bAcceptGzip && sp.size() >= ApiMinCompressSize &&
+        ApipGzipCompress(sp, iLevel, t_rbGzip) == Z_OK &&
+        t_rbGzip.Size() < sp.size())
+    {
+        Header[c++] = { "Content-Encoding", "gzip" };
+        Ctx.pSender->SendResponse(Ctx.dwConnId, usStatusCode, nullptr,
+            Header, (int)c, t_rbGzip.Data(), (int)t_rbGzip.Size());
+        if (t_rbGzip.Size() > ApiMaxRetainedJsonBuffer)
+            t_rbGzip = eck::CRefBin{};
+        return;
+    }
+    Ctx.pSender->SendResponse(Ctx.dwConnId, usStatusCode, nullptr,
+        Header, (int)c, sp.data(), (int)sp.size());
+}
+
 void ApiSendResponseJson(const API_CTX& Ctx, Json::CMutDoc& j,
     USHORT usStatusCode, const THeader* pHeader, size_t cHeader) noexcept
 {
     size_t cchJson;
     const auto pszJson = j.Write(cchJson, 0);
-    Ctx.pSender->SendResponse(Ctx.dwConnId, usStatusCode, nullptr,
-        pHeader, (int)cHeader, (const BYTE*)pszJson, (int)cchJson);
+    ApipSendJson(Ctx, { (const BYTE*)pszJson, cchJson },
+        usStatusCode, pHeader, cHeader);
     free(pszJson);
 }
+eck::CRefBin& ApiGetJsonBuffer() noexcept
+{
+    t_rbJson.Clear();
+    return t_rbJson;
+}
+void ApiSendResponseJson(const API_CTX& Ctx, eck::CRefBin& rbJson,
+    USHORT usStatusCode, const THeader* pHeader, size_t cHeader) noexcept
+{
+    ApipSendJson(Ctx, rbJson.ToSpan(), usStatusCode, pHeader, cHeader);
+    if (rbJson.Size() > ApiMaxRetainedJsonBuffer)
+        rbJson = eck::CRefBin{};
+    else
+        rbJson.Clear();
+}
 void ApiSendResponseBin(const API_CTX& Ctx, std::span<const BYTE> sp,
     USHORT usStatusCode, const THeader* pHeader, size_t cHeader) noexcept
 {
@@ -84,65 +373,20 @@ void ApiSendResponseBin(const API_CTX& Ctx, std::span<const BYTE> sp,
         pHeader, (int)cHeader, sp.data(), (int)sp.size());
 }
 
-void ApiMakeResourcePath(eck::CRefStrW& rsPath, std::wstring_view svResPath) noexcept
+// 静态资源缓存命中时已由CServer在I/O线程发送，此处处理需要读取文件的情况
+static void AwIndex(const API_CTX& Ctx) noexcept
 {
-    rsPath = eck::GetRunningPath();
-    rsPath.PushBack(EckStrAndLen(LR"(\res\dist)"));
-    rsPath.PushBack(svResPath);
+    SrSendFile(Ctx, L"\\index.html"sv);
 }
+TKK_API_DEF_ENTRY(ApiGet_Index, AwIndex)
 
-
-static void AwSendFileResource(const API_CTX& Ctx, std::wstring_view svResPath) noexcept
+void ApiSendResourceFile(API_CTX& Ctx, std::wstring_view svResPath) noexcept
 {
-    eck::CRefStrW rsPath{};
-    ApiMakeResourcePath(rsPath, svResPath);
-
-    NTSTATUS nts;
-    const auto rb = eck::ReadInFile(rsPath.Data(), &nts);
-    if (!NT_SUCCESS(nts))
+    if (ApiPreAction(Ctx))
     {
-        Ctx.pSender->SendResponse(Ctx.dwConnId, HSC_NOT_FOUND, "Not Found",
-            nullptr, 0, nullptr, 0);
-        return;
+        SrSendFile(Ctx, svResPath);
+        ApiPostAction(Ctx);
     }
-    Ctx.pSender->SendResponse(Ctx.dwConnId,
-        HSC_OK, "OK",
-        nullptr, 0,
-        rb.Data(), (int)rb.Size());
-}
-EnHttpParseResult ApiGet_Index(const API_CTX& Ctx) noexcept
-{
-    Ctx.pExtra->IncRef();
-    eck::TpSubmitSimpleCallback(nullptr, [Ctx](PTP_CALLBACK_INSTANCE) noexcept
-        {
-            if (ApiPreAction(Ctx))
-            {
-                AwSendFileResource(Ctx, L"\\index.html"sv);
-                ApiPostAction(Ctx);
-            }
-        });
-    return HPR_OK;
-}
-EnHttpParseResult ApiGet_ResourceFile(const API_CTX& Ctx) noexcept
-{
-    Ctx.pExtra->IncRef();
-    eck::TpSubmitSimpleCallback(nullptr, [Ctx](PTP_CALLBACK_INSTANCE) noexcept
-        {
-            if (ApiPreAction(Ctx))
-            {
-                const auto pszPath = Ctx.pSender->GetUrlField(Ctx.dwConnId, HUF_PATH);
-                if (pszPath && *pszPath)
-                {
-                    const auto rsPathW = eck::StrU82W(pszPath);
-                    AwSendFileResource(Ctx, rsPathW.ToStringView());
-                }
-                else
-                {
-                    Ctx.pSender->SendResponse(Ctx.dwConnId, HSC_NOT_FOUND, "Not Found",
-                        nullptr, 0, nullptr, 0);
-                }
-                ApiPostAction(Ctx);
-            }
-        });
-    return HPR_OK;
+    else
+        Ctx.pExtra->DecRef();
 }
\ No newline at end of file
@@ -1,11 +1,47 @@
 ﻿#pragma once
 #include "CServer.h"
 
+// 接口处理前需取得的资源
+enum class ApiRes : BYTE
+{
+    None = 0,
+    Db = (1u << 0),     // 主库连接
+    PvDb = (1u << 1),   // 文章版本库连接
+    Auth = (1u << 2),   // 预先解析当前用户，须同时指定Db
+};
+ECK_ENUM_BIT_FLAGS(ApiRes);
+
+struct QUERY_KV
+{
+    std::string_view K{};
+    std::string_view V{};// 未经URL解码
+};
+
+constexpr inline size_t ApiMaxQueryKv = 16;
+
+// 请求视图，分派前解析一次，所有视图均引用HPSocket持有的请求数据
+struct API_REQUEST
+{
+    QUERY_KV Query[ApiMaxQueryKv]{};// 超出容量的参数被忽略
+    BYTE cQuery{};
+    std::string_view svSid{};// Cookie中的sid，长度不正确时为空
+    BOOL bAcceptGzip{};
+};
+
 struct API_CTX
 {
     IHttpServer* pSender{};
     CONNID dwConnId{};
     ConnectionData* pExtra{};
+    ApiRes eRes{};
+    // 本次请求独占的数据库连接，由ApiPreAction借出，ApiPostAction归还
+    // 同一TCP连接上的并发请求各自借出，互不共享
+    sqlite3* pSqlite{};
+    sqlite3* pSqlitePv{};
+    // 以下字段仅当eRes含Auth时由ApiPreAction填充
+    int iUserId{};
+    int iPseudoUserId{};
+    API_REQUEST Req{};
 };
 
 enum class ApiResult
@@ -28,65 +64,76 @@ enum class ApiResult
     InvalidPassword,// 密码错误
 };
 
-EnHttpParseResult ApiGet_Index(const API_CTX& Ctx) noexcept;
-EnHttpParseResult ApiGet_ResourceFile(const API_CTX& Ctx) noexcept;
+// 解析查询字符串与Cookie，填充Ctx.Req，不分配内存
+void ApiParseRequest(API_CTX& Ctx) noexcept;
+// 判断Accept-Encoding是否接受gzip
+BOOL ApiAcceptGzip(PCSTR pszAcceptEncoding) noexcept;
+// 设置JSON响应的gzip压缩级别，0禁用压缩，-1为zlib默认级别
+void ApiSetCompressLevel(int iLevel) noexcept;
+
+// 以下接口入口均在线程池中执行，由CServer按路由类型调度
+
+void ApiGet_Index(API_CTX& Ctx) noexcept;
+// 发送res\dist下的静态资源，svResPath以路径分隔符开头
+void ApiSendResourceFile(API_CTX& Ctx, std::wstring_view svResPath) noexcept;
 
 // Project
 
-EnHttpParseResult ApiPost_InsertProject(const API_CTX& Ctx) noexcept;
-EnHttpParseResult ApiPost_DeleteProject(const API_CTX& Ctx) noexcept;
-EnHttpParseResult ApiPost_UpdateProject(const API_CTX& Ctx) noexcept;
-EnHttpParseResult ApiGet_ProjectList(const API_CTX& Ctx) noexcept;
+void ApiPost_InsertProject(API_CTX& Ctx) noexcept;
+void ApiPost_DeleteProject(API_CTX& Ctx) noexcept;
+void ApiPost_UpdateProject(API_CTX& Ctx) noexcept;
+void ApiGet_ProjectList(API_CTX& Ctx) noexcept;
 
 // Task
 
-EnHttpParseResult ApiPost_InsertTask(const API_CTX& Ctx) noexcept;
-EnHttpParseResult ApiPost_DeleteTask(const API_CTX& Ctx) noexcept;
-EnHttpParseResult ApiPost_UpdateTask(const API_CTX& Ctx) noexcept;
-EnHttpParseResult ApiGet_TaskList(const API_CTX& Ctx) noexcept;
+void ApiPost_InsertTask(API_CTX& Ctx) noexcept;
+void ApiPost_DeleteTask(API_CTX& Ctx) noexcept;
+void ApiPost_UpdateTask(API_CTX& Ctx) noexcept;
+void ApiGet_TaskList(API_CTX& Ctx) noexcept;
 
-EnHttpParseResult ApiGet_TaskLogList(const API_CTX& Ctx) noexcept;
+void ApiGet_TaskLogList(API_CTX& Ctx) noexcept;
 
-EnHttpParseResult ApiPost_InsertTaskRelation(const API_CTX& Ctx) noexcept;
-EnHttpParseResult ApiPost_DeleteTaskRelation(const API_CTX& Ctx) noexcept;
-EnHttpParseResult ApiGet_TaskRelationList(const API_CTX& Ctx) noexcept;
+void ApiPost_InsertTaskRelation(API_CTX& Ctx) noexcept;
+void ApiPost_DeleteTaskRelation(API_CTX& Ctx) noexcept;
+void ApiGet_TaskRelationList(API_CTX& Ctx) noexcept;
 
-EnHttpParseResult ApiPost_InsertTaskComment(const API_CTX& Ctx) noexcept;
-EnHttpParseResult ApiPost_DeleteTaskComment(const API_CTX& Ctx) noexcept;
-EnHttpParseResult ApiPost_UpdateTaskComment(const API_CTX& Ctx) noexcept;
-EnHttpParseResult ApiGet_TaskCommentList(const API_CTX& Ctx) noexcept;
+void ApiPost_InsertTaskComment(API_CTX& Ctx) noexcept;
+void ApiPost_DeleteTaskComment(API_CTX& Ctx) noexcept;
+void ApiPost_UpdateTaskComment(API_CTX& Ctx) noexcept;
+void ApiGet_TaskCommentList(API_CTX& Ctx) noexcept;
 
 // PageGroup
 
-EnHttpParseResult ApiPost_InsertPageGroup(const API_CTX& Ctx) noexcept;
-EnHttpParseResult ApiPost_DeletePageGroup(const API_CTX& Ctx) noexcept;
-EnHttpParseResult ApiPost_UpdatePageGroup(const API_CTX& Ctx) noexcept;
-EnHttpParseResult ApiGet_PageGroupList(const API_CTX& Ctx) noexcept;
+void ApiPost_InsertPageGroup(API_CTX& Ctx) noexcept;
+void ApiPost_DeletePageGroup(API_CTX& Ctx) noexcept;
+void ApiPost_UpdatePageGroup(API_CTX& Ctx) noexcept;
+void ApiGet_PageGroupList(API_CTX& Ctx) noexcept;
 
 // Page
 
-EnHttpParseResult ApiPost_InsertPage(const API_CTX& Ctx) noexcept;
-EnHttpParseResult ApiPost_DeletePage(const API_CTX& Ctx) noexcept;
-EnHttpParseResult ApiPost_UpdatePage(const API_CTX& Ctx) noexcept;
-EnHttpParseResult ApiGet_PageList(const API_CTX& Ctx) noexcept;
+void ApiPost_InsertPage(API_CTX& Ctx) noexcept;
+void ApiPost_DeletePage(API_CTX& Ctx) noexcept;
+void ApiPost_UpdatePage(API_CTX& Ctx) noexcept;
+void ApiGet_PageList(API_CTX& Ctx) noexcept;
 
-EnHttpParseResult ApiPost_PageSave(const API_CTX& Ctx) noexcept;
-EnHttpParseResult ApiGet_PageLoad(const API_CTX& Ctx) noexcept;
+void ApiPost_PageSave(API_CTX& Ctx) noexcept;
+void ApiGet_PageLoad(API_CTX& Ctx) noexcept;
 
-EnHttpParseResult ApiGet_PageVersionList(const API_CTX& Ctx) noexcept;
-EnHttpParseResult ApiGet_PageVersionContent(const API_CTX& Ctx) noexcept;
+void ApiGet_PageVersionList(API_CTX& Ctx) noexcept;
+void ApiGet_PageVersionContent(API_CTX& Ctx) noexcept;
 
 // Auth
 
-EnHttpParseResult ApiGet_Login(const API_CTX& Ctx) noexcept;
-EnHttpParseResult ApiPost_Register(const API_CTX& Ctx) noexcept;
+void ApiGet_Login(API_CTX& Ctx) noexcept;
+void ApiPost_Register(API_CTX& Ctx) noexcept;
 
 // Search
 
-EnHttpParseResult ApiGet_SearchEntity(const API_CTX& Ctx) noexcept;
+void ApiGet_SearchEntity(API_CTX& Ctx) noexcept;
+void ApiGet_SearchContent(API_CTX& Ctx) noexcept;
 
 // Acl
 
-EnHttpParseResult ApiPost_ModifyAccess(const API_CTX& Ctx) noexcept;
-EnHttpParseResult ApiPost_ModifyAccessUser(const API_CTX& Ctx) noexcept;
-EnHttpParseResult ApiGet_Acl(const API_CTX& Ctx) noexcept;
\ No newline at end of file
+void ApiPost_ModifyAccess(API_CTX& Ctx) noexcept;
+void ApiPost_ModifyAccessUser(API_CTX& Ctx) noexcept;
+void ApiGet_Acl(API_CTX& Ctx) noexcept;
\ No newline at end of file
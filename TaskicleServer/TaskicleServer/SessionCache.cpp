@@ -0,0 +1,174 @@
+﻿#include "pch.h"
+#include "Database.h"
+#include "SessionCache.h"
+
+constexpr static size_t CkShardCount = 16;
+constexpr static size_t CkWheelSlotCount = 256;
+constexpr static ULONGLONG CkWheelSlotMs = 60 * 60 * 1000;// 1小时
+
+struct CK_SID_KEY
+{
+    char ch[CkSidStrLen];
+
+    bool operator==(const CK_SID_KEY& x) const noexcept
+    {
+        return memcmp(ch, x.ch, CkSidStrLen) == 0;
+    }
+};
+struct CK_SID_KEY_HASH
+{
+    size_t operator()(const CK_SID_KEY& k) const noexcept
+    {
+        return std::hash<std::string_view>{}({ k.ch, CkSidStrLen });
+    }
+};
+
+struct CK_SESSION_SHARD
+{
+    eck::CSrwLock Lk{};
+    std::unordered_map<CK_SID_KEY, CK_SESSION, CK_SID_KEY_HASH> Map{};
+    // 时间轮，按过期时间所在的小时分槽，槽中的键可能已被移除
+    std::vector<CK_SID_KEY> Wheel[CkWheelSlotCount]{};
+};
+
+struct CK_USER_ENTRY
+{
+    CK_SID_KEY Sid;
+    ULONGLONG tExpire;
+    ULONGLONG nGen;// 由CkCachePopulate载入时沿用原值
+};
+struct CK_USER_SHARD
+{
+    eck::CSrwLock Lk{};
+    // 用户ID -> 当前会话，表项可能已过期
+    std::unordered_map<int, CK_USER_ENTRY> Map{};
+};
+
+static CK_SESSION_SHARD s_CkSessionShard[CkShardCount]{};
+static CK_USER_SHARD s_CkUserShard[CkShardCount]{};
+// 时间轮上次推进到的小时
+static std::atomic<ULONGLONG> s_CkWheelHour{};
+// 会话写入代数，全局递增，按用户比较
+static std::atomic<ULONGLONG> s_CkGeneration{};
+
+static const CK_SID_KEY& CkpToKey(PCCH pszSid) noexcept
+{
+    return *(const CK_SID_KEY*)pszSid;
+}
+
+static CK_SESSION_SHARD& CkpGetSessionShard(const CK_SID_KEY& Key) noexcept
+{
+    return s_CkSessionShard[CK_SID_KEY_HASH{}(Key) % CkShardCount];
+}
+
+static CK_USER_SHARD& CkpGetUserShard(int iUserId) noexcept
+{
+    return s_CkUserShard[(UINT)iUserId % CkShardCount];
+}
+
+static void CkpInsert(const CK_SID_KEY& Key, const CK_SESSION& Session) noexcept
+{
+    auto& Shard = CkpGetSessionShard(Key);
+    eck::CSrwWriteGuard _{ Shard.Lk };
+    Shard.Map.insert_or_assign(Key, Session);
+    Shard.Wheel[(Session.tExpire / CkWheelSlotMs) % CkWheelSlotCount].emplace_back(Key);
+}
+
+static void CkpErase(const CK_SID_KEY& Key) noexcept
+{
+    auto& Shard = CkpGetSessionShard(Key);
+    eck::CSrwWriteGuard _{ Shard.Lk };
+    Shard.Map.erase(Key);
+}
+
+BOOL CkCacheLookup(_In_reads_(CkSidStrLen) PCCH pszSid,
+    ULONGLONG tNow, _Out_ CK_SESSION& Session) noexcept
+{
+    const auto& Key = CkpToKey(pszSid);
+    auto& Shard = CkpGetSessionShard(Key);
+    eck::CSrwReadGuard _{ Shard.Lk };
+    const auto it = Shard.Map.find(Key);
+    if (it == Shard.Map.end() || it->second.tExpire <= tNow)
+        return FALSE;
+    Session = it->second;
+    return TRUE;
+}
+
+ULONGLONG CkCacheNextGeneration() noexcept
+{
+    return s_CkGeneration.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+// 调用方须持有用户分片的写锁
+static void CkpStoreLocked(CK_USER_SHARD& User, const CK_SID_KEY& Key,
+    const CK_SESSION& Session, ULONGLONG nGen) noexcept
+{
+    const auto it = User.Map.find(Session.iUserId);
+    if (it != User.Map.end())
+    {
+        if (!(it->second.Sid == Key))
+            CkpErase(it->second.Sid);
+        it->second = { Key, Session.tExpire, nGen };
+    }
+    else
+        User.Map.emplace(Session.iUserId, CK_USER_ENTRY{ Key, Session.tExpire, nGen });
+    CkpInsert(Key, Session);
+}
+
+void CkCacheStore(_In_reads_(CkSidStrLen) PCCH pszSid,
+    const CK_SESSION& Session, ULONGLONG nGen) noexcept
+{
+    auto& User = CkpGetUserShard(Session.iUserId);
+    eck::CSrwWriteGuard _{ User.Lk };
+    const auto it = User.Map.find(Session.iUserId);
+    // 提交较晚的登录已先写入缓存
+    if (it != User.Map.end() && it->second.nGen > nGen)
+        return;
+    CkpStoreLocked(User, CkpToKey(pszSid), Session, nGen);
+}
+
+void CkCachePopulate(_In_reads_(CkSidStrLen) PCCH pszSid,
+    const CK_SESSION& Session) noexcept
+{
+    const auto& Key = CkpToKey(pszSid);
+    auto& User = CkpGetUserShard(Session.iUserId);
+    eck::CSrwWriteGuard _{ User.Lk };
+    const auto it = User.Map.find(Session.iUserId);
+    // 查询数据库后该用户可能已重新登录
+    if (it != User.Map.end() && !(it->second.Sid == Key) &&
+        it->second.tExpire >= Session.tExpire)
+        return;
+    CkpStoreLocked(User, Key, Session, it != User.Map.end() ? it->second.nGen : 0);
+}
+
+BOOL CkCacheAdvance(ULONGLONG tNow) noexcept
+{
+    const auto ullHour = tNow / CkWheelSlotMs;
+    auto ullLast = s_CkWheelHour.load(std::memory_order_relaxed);
+    if (ullHour <= ullLast)
+        return FALSE;
+    if (!s_CkWheelHour.compare_exchange_strong(ullLast, ullHour))
+        return FALSE;
+    // 处理[ullLast, ullHour)中的槽，这些槽中的会话均已在本小时之前过期
+    const auto cSlot = std::min(ullHour - ullLast, (ULONGLONG)CkWheelSlotCount);
+    for (auto& Shard : s_CkSessionShard)
+    {
+        eck::CSrwWriteGuard _{ Shard.Lk };
+        for (ULONGLONG i = 0; i < cSlot; ++i)
+        {
+            auto& vSlot = Shard.Wheel[(ullHour - 1 - i) % CkWheelSlotCount];
+            // 槽与小时多对一，保留尚未过期的键
+            std::erase_if(vSlot, [&](const CK_SID_KEY& Key)
+                {
+                    const auto it = Shard.Map.find(Key);
+                    if (it == Shard.Map.end())
+                        return true;
+                    if (it->second.tExpire > tNow)
+                        return false;
+                    Shard.Map.erase(it);
+                    return true;
+                });
+        }
+    }
+    return TRUE;
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+﻿#pragma once
+struct CK_SID
+{
+    char Hdr[4];
+    UINT Random[6];
+    ULONGLONG TimeStamp;
+};
+constexpr inline size_t CkSidStrLen = 2 * sizeof(CK_SID);
+
+struct CK_SESSION
+{
+    int iUserId;
+    DbUserRole eRole;
+    ULONGLONG tExpire;// Unix时间戳，毫秒
+};
+
+// 查找会话，未命中或已过期返回FALSE
+BOOL CkCacheLookup(_In_reads_(CkSidStrLen) PCCH pszSid,
+    ULONGLONG tNow, _Out_ CK_SESSION& Session) noexcept;
+
+// 取得新的写入代数，须在写UserSession的事务中调用
+// 写事务互斥，因此代数的顺序与提交顺序一致
+ULONGLONG CkCacheNextGeneration() noexcept;
+// 写入会话并移除该用户先前的会话，须在事务提交成功后调用
+// 若该用户已写入代数更大的会话则忽略
+void CkCacheStore(_In_reads_(CkSidStrLen) PCCH pszSid,
+    const CK_SESSION& Session, ULONGLONG nGen) noexcept;
+// 缓存未命中时将数据库中的会话载入缓存
+// 若该用户已有更新的会话则不载入
+void CkCachePopulate(_In_reads_(CkSidStrLen) PCCH pszSid,
+    const CK_SESSION& Session) noexcept;
+
+// 推进时间轮并移除过期会话，每个时间槽为一小时
+// 返回TRUE表示本线程进行了推进，调用方应同步清理UserSession表
+BOOL CkCacheAdvance(ULONGLONG tNow) noexcept;
\ No newline at end of file
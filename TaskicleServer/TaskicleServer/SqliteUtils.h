@@ -17,11 +17,13 @@ public:
             sqlite3_exec(m_pSqlite, "ROLLBACK;", nullptr, nullptr, nullptr);
     }
 
-    void Commit() noexcept
+    // 返回sqlite错误码，失败时事务仍未结束，析构时回滚
+    int Commit() noexcept
     {
         EckAssert(!m_bCommitted);
-        m_bCommitted = TRUE;
-        sqlite3_exec(m_pSqlite, "COMMIT;", nullptr, nullptr, nullptr);
+        const auto r = sqlite3_exec(m_pSqlite, "COMMIT;", nullptr, nullptr, nullptr);
+        m_bCommitted = (r == SQLITE_OK);
+        return r;
     }
 };
 
@@ -64,4 +66,30 @@ inline void SuEscapeLikeQuery(std::string_view sv,
             rsEscaped.PushBackChar('\\');
         rsEscaped.PushBackChar(ch);
     }
+}
+
+// 将用户输入转为FTS5前缀查询，以空白或+分隔的每个词均作为前缀匹配，各词之间为AND
+// 词被引号包裹，用户输入中的FTS5语法字符不起作用，没有词时rsQuery为空
+inline void SuMakeFtsPrefixQuery(std::string_view sv,
+    eck::CRefStrA& rsQuery) noexcept
+{
+    rsQuery.Reserve(rsQuery.Size() + int(sv.size() + 8));
+    size_t i = 0;
+    while (i < sv.size())
+    {
+        while (i < sv.size() && (sv[i] == ' ' || sv[i] == '\t' || sv[i] == '+'))
+            ++i;
+        if (i == sv.size())
+            break;
+        if (!rsQuery.IsEmpty())
+            rsQuery.PushBackChar(' ');
+        rsQuery.PushBackChar('"');
+        for (; i < sv.size() && sv[i] != ' ' && sv[i] != '\t' && sv[i] != '+'; ++i)
+        {
+            if (sv[i] == '"')
+                rsQuery.PushBackChar('"');
+            rsQuery.PushBackChar(sv[i]);
+        }
+        rsQuery.PushBack("\"*"sv);
+    }
 }
\ No newline at end of file
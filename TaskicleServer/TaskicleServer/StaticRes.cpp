@@ -0,0 +1,393 @@
+﻿#include "pch.h"
+#include "StaticRes.h"
+
+// 同一资源两次检查文件修改的最小间隔
+constexpr static ULONGLONG SrCheckIntervalMs = 1000;
+// 超出此长度的文件不缓存也不压缩，每次从磁盘分块发送
+constexpr static size_t SrMaxCachedFileSize = 16 * 1024 * 1024;
+// 缓存中原文与压缩数据的总字节数上限，超出时淘汰最久未检查的资源
+constexpr static size_t SrMaxCacheBytes = 128 * 1024 * 1024;
+// 分块发送大文件时每块的长度
+constexpr static DWORD SrStreamChunkSize = 64 * 1024;
+// 小于此长度的文件不压缩
+constexpr static size_t SrMinCompressSize = 1024;
+
+struct SR_CONTENT_TYPE
+{
+    std::wstring_view svExt;
+    PCSTR pszType;
+    BOOL bCompress;
+};
+constexpr static SR_CONTENT_TYPE SrContentType[]
+{
+    { L".html"sv,  "text/html; charset=utf-8",               TRUE  },
+    { L".js"sv,    "text/javascript; charset=utf-8",         TRUE  },
+    { L".mjs"sv,   "text/javascript; charset=utf-8",         TRUE  },
+    { L".css"sv,   "text/css; charset=utf-8",                TRUE  },
+    { L".json"sv,  "application/json; charset=utf-8",        TRUE  },
+    { L".map"sv,   "application/json; charset=utf-8",        TRUE  },
+    { L".txt"sv,   "text/plain; charset=utf-8",              TRUE  },
+    { L".svg"sv,   "image/svg+xml",                          TRUE  },
+    { L".ico"sv,   "image/x-icon",                           TRUE  },
+    { L".wasm"sv,  "application/wasm",                       TRUE  },
+    { L".png"sv,   "image/png",                              FALSE },
+    { L".jpg"sv,   "image/jpeg",                             FALSE },
+    { L".jpeg"sv,  "image/jpeg",                             FALSE },
+    { L".gif"sv,   "image/gif",                              FALSE },
+    { L".webp"sv,  "image/webp",                             FALSE },
+    { L".woff"sv,  "font/woff",                              FALSE },
+    { L".woff2"sv, "font/woff2",                             FALSE },
+    { L".ttf"sv,   "font/ttf",                               TRUE  },
+};
+constexpr static SR_CONTENT_TYPE SrDefaultContentType
+{
+    {}, "application/octet-stream", FALSE
+};
+
+// 文件名含散列的资源内容随名称改变，可永久缓存
+constexpr static char SrCacheControlImmutable[]{ "public, max-age=31536000, immutable" };
+// 其他资源每次使用前须以ETag验证
+constexpr static char SrCacheControlRevalidate[]{ "no-cache" };
+
+struct SR_FILE
+{
+    eck::CRefBin rbRaw{};
+    eck::CRefBin rbGzip{};// 为空表示不压缩
+    char szETag[32]{};
+    char szETagGzip[40]{};// 压缩版本是不同的表示，须使用不同的强ETag
+    PCSTR pszContentType{};
+    PCSTR pszCacheControl{};
+    ULONGLONG ftLastWrite{};
+    ULONGLONG cbFile{};
+    std::atomic<ULONGLONG> tLastCheck{};
+};
+
+static eck::CSrwLock s_SrLock{};
+// 小写的相对路径 -> 资源
+static std::unordered_map<std::wstring, std::shared_ptr<SR_FILE>> s_SrFile{};
+// s_SrFile中所有资源占用的字节数，受s_SrLock保护
+static size_t s_cbSrFile{};
+
+static void SrpMakePath(eck::CRefStrW& rsPath, std::wstring_view svResPath) noexcept
+{
+    rsPath = eck::GetRunningPath();
+    rsPath.PushBack(EckStrAndLen(LR"(\res\dist)"));
+    rsPath.PushBack(svResPath);
+}
+
+static const SR_CONTENT_TYPE& SrpGetContentType(std::wstring_view svFileName) noexcept
+{
+    const auto posDot = svFileName.rfind(L'.');
+    if (posDot == std::wstring_view::npos)
+        return SrDefaultContentType;
+    const auto svExt = svFileName.substr(posDot);
+    for (const auto& e : SrContentType)
+        if (eck::TcsEqualLen2I(svExt.data(), svExt.size(), e.svExt.data(), e.svExt.size()))
+            return e;
+    return SrDefaultContentType;
+}
+
+// 构建工具生成的文件名形如app.1a2b3c4d.js，判断扩展名前是否有至少8位的十六进制段
+static BOOL SrpIsHashedFileName(std::wstring_view svFileName) noexcept
+{
+    const auto posExt = svFileName.rfind(L'.');
+    if (posExt == std::wstring_view::npos)
+        return FALSE;
+    size_t posSeg{};
+    for (size_t i{}; i <= posExt; ++i)
+    {
+        const auto ch = svFileName[i];
+        if (ch != L'.' && ch != L'-')
+            continue;
+        const auto svSeg = svFileName.substr(posSeg, i - posSeg);
+        if (svSeg.size() >= 8 && std::all_of(svSeg.begin(), svSeg.end(),
+            [](WCHAR ch) { return iswxdigit(ch); }))
+            return TRUE;
+        posSeg = i + 1;
+    }
+    return FALSE;
+}
+
+// 载入文件并生成压缩版本和ETag
+static NTSTATUS SrpLoadFile(PCWSTR pszPath, std::wstring_view svFileName,
+    ULONGLONG ftLastWrite, SR_FILE& File) noexcept
+{
+    NTSTATUS nts;
+    File.rbRaw = eck::ReadInFile(pszPath, &nts);
+    if (!NT_SUCCESS(nts))
+        return nts;
+    const auto& Type = SrpGetContentType(svFileName);
+    File.pszContentType = Type.pszType;
+    File.pszCacheControl = (SrpIsHashedFileName(svFileName) ?
+        SrCacheControlImmutable : SrCacheControlRevalidate);
+    File.ftLastWrite = ftLastWrite;
+    File.cbFile = File.rbRaw.Size();
+    const auto uCrc = eck::CalculateCrc32(File.rbRaw.Data(), File.rbRaw.Size());
+    sprintf_s(File.szETag, "\"%08X%016llX\"", uCrc, File.cbFile);
+    sprintf_s(File.szETagGzip, "\"%08X%016llX-gz\"", uCrc, File.cbFile);
+    if (Type.bCompress && File.rbRaw.Size() >= SrMinCompressSize)
+    {
+        const auto r = eck::GZipCompress(File.rbRaw.Data(),
+            File.rbRaw.Size(), File.rbGzip);
+        // 压缩失败或无收益时发送原文
+        if (!eck::ZLibSuccess(r) || File.rbGzip.Size() >= File.rbRaw.Size())
+            File.rbGzip.Clear();
+    }
+    File.tLastCheck.store(GetTickCount64(), std::memory_order_relaxed);
+    return STATUS_SUCCESS;
+}
+
+// 缓存键为小写的相对路径
+static std::wstring SrpMakeKey(std::wstring_view svResPath) noexcept
+{
+    std::wstring Key(svResPath);
+    for (auto& ch : Key)
+        ch = eck::TchToLower(ch);
+    return Key;
+}
+
+// 仅查找缓存，不访问文件系统
+static std::shared_ptr<SR_FILE> SrpLookupFile(const std::wstring& Key) noexcept
+{
+    eck::CSrwReadGuard _{ s_SrLock };
+    const auto it = s_SrFile.find(Key);
+    if (it != s_SrFile.end())
+        return it->second;
+    return nullptr;
+}
+
+static BOOL SrpIsFresh(const SR_FILE& File, ULONGLONG tNow) noexcept
+{
+    return tNow - File.tLastCheck.load(std::memory_order_relaxed) < SrCheckIntervalMs;
+}
+
+static size_t SrpCachedSize(const SR_FILE& File) noexcept
+{
+    return File.rbRaw.Size() + File.rbGzip.Size();
+}
+
+// 调用方须持有s_SrLock写锁
+static void SrpEraseFileLocked(decltype(s_SrFile)::iterator it) noexcept
+{
+    s_cbSrFile -= SrpCachedSize(*it->second);
+    s_SrFile.erase(it);
+}
+
+// 插入或替换资源，总字节数超出上限时先淘汰最久未检查的资源
+static void SrpCacheFile(std::wstring&& Key, const std::shared_ptr<SR_FILE>& pFile) noexcept
+{
+    const auto cbNew = SrpCachedSize(*pFile);
+    eck::CSrwWriteGuard _{ s_SrLock };
+    if (const auto it = s_SrFile.find(Key); it != s_SrFile.end())
+        SrpEraseFileLocked(it);
+    while (!s_SrFile.empty() && s_cbSrFile + cbNew > SrMaxCacheBytes)
+    {
+        const auto itOldest = std::min_element(s_SrFile.begin(), s_SrFile.end(),
+            [](const auto& a, const auto& b)
+            {
+                return a.second->tLastCheck.load(std::memory_order_relaxed) <
+                    b.second->tLastCheck.load(std::memory_order_relaxed);
+            });
+        SrpEraseFileLocked(itOldest);
+    }
+    s_SrFile.emplace(std::move(Key), pFile);
+    s_cbSrFile += cbNew;
+}
+
+// 取缓存的资源，必要时检查文件修改并重新载入
+// 失败或文件过大时返回nullptr，文件过大时cbFile大于SrMaxCachedFileSize，由调用方分块发送
+// 返回的资源只对本次请求有效
+static std::shared_ptr<SR_FILE> SrpGetFile(std::wstring_view svResPath,
+    eck::CRefStrW& rsPath, ULONGLONG& ftLastWrite, ULONGLONG& cbFile) noexcept
+{
+    auto Key = SrpMakeKey(svResPath);
+    auto pFile = SrpLookupFile(Key);
+    const auto tNow = GetTickCount64();
+    if (pFile && SrpIsFresh(*pFile, tNow))
+        return pFile;
+
+    cbFile = 0;
+    SrpMakePath(rsPath, svResPath);
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    if (!GetFileAttributesExW(rsPath.Data(), GetFileExInfoStandard, &fad) ||
+        (fad.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+    {
+        if (pFile)
+        {
+            eck::CSrwWriteGuard _{ s_SrLock };
+            if (const auto it = s_SrFile.find(Key); it != s_SrFile.end())
+                SrpEraseFileLocked(it);
+        }
+        return nullptr;
+    }
+    ftLastWrite = ((ULONGLONG)fad.ftLastWriteTime.dwHighDateTime << 32) |
+        fad.ftLastWriteTime.dwLowDateTime;
+    cbFile = ((ULONGLONG)fad.nFileSizeHigh << 32) | fad.nFileSizeLow;
+    if (pFile && pFile->ftLastWrite == ftLastWrite && pFile->cbFile == cbFile)
+    {
+        pFile->tLastCheck.store(tNow, std::memory_order_relaxed);
+        return pFile;
+    }
+    // 文件变大后旧版本不再有效
+    if (cbFile > SrMaxCachedFileSize)
+    {
+        if (pFile)
+        {
+            eck::CSrwWriteGuard _{ s_SrLock };
+            if (const auto it = s_SrFile.find(Key); it != s_SrFile.end())
+                SrpEraseFileLocked(it);
+        }
+        return nullptr;
+    }
+
+    const auto svFileName = svResPath.substr(svResPath.find_last_of(L"\\/") + 1);
+    auto pNew = std::make_shared<SR_FILE>();
+    if (!NT_SUCCESS(SrpLoadFile(rsPath.Data(), svFileName, ftLastWrite, *pNew)))
+        return nullptr;
+    SrpCacheFile(std::move(Key), pNew);
+    return pNew;
+}
+
+// 判断If-None-Match是否与ETag匹配，比较时忽略弱验证器前缀
+static BOOL SrpMatchETag(PCSTR pszIfNoneMatch, PCSTR pszETag) noexcept
+{
+    const std::string_view svETag{ pszETag };
+    std::string_view sv{ pszIfNoneMatch };
+    while (!sv.empty())
+    {
+        const auto posComma = sv.find(',');
+        auto svItem = sv.substr(0, posComma);
+        sv = (posComma == std::string_view::npos ? std::string_view{} : sv.substr(posComma + 1));
+        while (!svItem.empty() && svItem.front() == ' ')
+            svItem.remove_prefix(1);
+        while (!svItem.empty() && svItem.back() == ' ')
+            svItem.remove_suffix(1);
+        if (svItem == "*"sv)
+            return TRUE;
+        if (svItem.starts_with("W/"sv))
+            svItem.remove_prefix(2);
+        if (svItem == svETag)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static void SrpSendFile(const API_CTX& Ctx, const SR_FILE* pFile) noexcept
+{
+    PCSTR pszHeader;
+    // 先确定表示再比较ETag，避免以原文的ETag验证压缩版本
+    const auto bGzip = !pFile->rbGzip.IsEmpty() &&
+        Ctx.pSender->GetHeader(Ctx.dwConnId, "Accept-Encoding", &pszHeader) &&
+        ApiAcceptGzip(pszHeader);
+    const auto pszETag = (bGzip ? pFile->szETagGzip : pFile->szETag);
+    THeader Header[]
+    {
+        { "ETag", pszETag },
+        { "Cache-Control", pFile->pszCacheControl },
+        { "Vary", "Accept-Encoding" },
+        { "Content-Type", pFile->pszContentType },
+        { "Content-Encoding", "gzip" },
+    };
+    if (Ctx.pSender->GetHeader(Ctx.dwConnId, "If-None-Match", &pszHeader) &&
+        SrpMatchETag(pszHeader, pszETag))
+    {
+        Ctx.pSender->SendResponse(Ctx.dwConnId, HSC_NOT_MODIFIED, "Not Modified",
+            Header, 3, nullptr, 0);
+        return;
+    }
+
+    const auto& rb = (bGzip ? pFile->rbGzip : pFile->rbRaw);
+    Ctx.pSender->SendResponse(Ctx.dwConnId, HSC_OK, "OK",
+        Header, bGzip ? 5 : 4, rb.Data(), (int)rb.Size());
+}
+
+// 分块发送不缓存的大文件，不压缩
+// 不读取全部内容计算校验值，ETag由修改时间和长度生成，因此为弱验证器
+static void SrpStreamFile(const API_CTX& Ctx, std::wstring_view svResPath,
+    PCWSTR pszPath, ULONGLONG ftLastWrite, ULONGLONG cbFile) noexcept
+{
+    const auto svFileName = svResPath.substr(svResPath.find_last_of(L"\\/") + 1);
+    char szETag[48];
+    sprintf_s(szETag, "W/\"%016llX%016llX\"", ftLastWrite, cbFile);
+    THeader Header[]
+    {
+        { "ETag", szETag },
+        { "Cache-Control", SrpIsHashedFileName(svFileName) ?
+            SrCacheControlImmutable : SrCacheControlRevalidate },
+        { "Content-Type", SrpGetContentType(svFileName).pszType },
+        { "Transfer-Encoding", "chunked" },
+    };
+    PCSTR pszHeader;
+    if (Ctx.pSender->GetHeader(Ctx.dwConnId, "If-None-Match", &pszHeader) &&
+        SrpMatchETag(pszHeader, szETag + 2))
+    {
+        Ctx.pSender->SendResponse(Ctx.dwConnId, HSC_NOT_MODIFIED, "Not Modified",
+            Header, 2, nullptr, 0);
+        return;
+    }
+
+    const auto hFile = CreateFileW(pszPath, GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        Ctx.pSender->SendResponse(Ctx.dwConnId, HSC_NOT_FOUND, "Not Found",
+            nullptr, 0, nullptr, 0);
+        return;
+    }
+    if (Ctx.pSender->SendResponse(Ctx.dwConnId, HSC_OK, "OK",
+        Header, ARRAYSIZE(Header), nullptr, 0))
+    {
+        const auto pBuf = std::make_unique_for_overwrite<BYTE[]>(SrStreamChunkSize);
+        DWORD cbRead;
+        BOOL bOk;
+        while ((bOk = ReadFile(hFile, pBuf.get(), SrStreamChunkSize, &cbRead, nullptr)) &&
+            cbRead)
+        {
+            if (!Ctx.pSender->SendChunkData(Ctx.dwConnId, pBuf.get(), (int)cbRead))
+                break;
+        }
+        // 读取出错时无法再改变状态码，只能断开连接
+        if (bOk && !cbRead)
+            Ctx.pSender->SendChunkData(Ctx.dwConnId);
+        else
+            Ctx.pSender->Release(Ctx.dwConnId);
+    }
+    CloseHandle(hFile);
+}
+
+void SrSendFile(const API_CTX& Ctx, std::wstring_view svResPath) noexcept
+{
+    // 禁止访问资源目录之外的文件
+    if (svResPath.find(L".."sv) != std::wstring_view::npos)
+    {
+        Ctx.pSender->SendResponse(Ctx.dwConnId, HSC_NOT_FOUND, "Not Found",
+            nullptr, 0, nullptr, 0);
+        return;
+    }
+    eck::CRefStrW rsPath{};
+    ULONGLONG ftLastWrite{}, cbFile{};
+    const auto pFile = SrpGetFile(svResPath, rsPath, ftLastWrite, cbFile);
+    if (!pFile && cbFile > SrMaxCachedFileSize)
+    {
+        SrpStreamFile(Ctx, svResPath, rsPath.Data(), ftLastWrite, cbFile);
+        return;
+    }
+    if (!pFile)
+    {
+        Ctx.pSender->SendResponse(Ctx.dwConnId, HSC_NOT_FOUND, "Not Found",
+            nullptr, 0, nullptr, 0);
+        return;
+    }
+    SrpSendFile(Ctx, pFile.get());
+}
+
+BOOL SrTrySendCached(const API_CTX& Ctx, std::wstring_view svResPath) noexcept
+{
+    if (svResPath.find(L".."sv) != std::wstring_view::npos)
+        return FALSE;
+    const auto pFile = SrpLookupFile(SrpMakeKey(svResPath));
+    if (!pFile || !SrpIsFresh(*pFile, GetTickCount64()))
+        return FALSE;
+    SrpSendFile(Ctx, pFile.get());
+    return TRUE;
+}
@@ -0,0 +1,9 @@
+﻿#pragma once
+#include "ServerApi.h"
+
+// 发送res\dist下的静态资源，svResPath以路径分隔符开头
+// 资源首次访问时载入内存并预压缩，文件修改后自动重新载入
+void SrSendFile(const API_CTX& Ctx, std::wstring_view svResPath) noexcept;
+// 资源已缓存且无需检查文件修改时直接发送，不访问文件系统，可在I/O线程调用
+// 返回FALSE时调用方应转入线程池调用SrSendFile
+BOOL SrTrySendCached(const API_CTX& Ctx, std::wstring_view svResPath) noexcept;
\ No newline at end of file
@@ -49,6 +49,11 @@ namespace dtl {
     {
     private:
         dtl_typedefs(elem, sequence)
+        // byte elements in contiguous storage with plain equality can be matched with SIMD
+        static constexpr bool byteSequence =
+            sizeof(elem) == 1 && std::is_integral_v<elem> &&
+            std::is_same_v<comparator, Compare< elem > > &&
+            std::contiguous_iterator<sequence_const_iter>;
     private:
         sequence           A;
         sequence           B;
@@ -543,8 +548,19 @@ namespace dtl {
             long long r = above > below ? path[(size_t)k - 1 + offset] : path[(size_t)k + 1 + offset];
             long long y = max(above, below);
             long long x = y - k;
-            while ((size_t)x < M && (size_t)y < N && (swapped ? cmp.impl(B[(size_t)y], A[(size_t)x]) : cmp.impl(A[(size_t)x], B[(size_t)y]))) {
-                ++x; ++y;
+            if constexpr (byteSequence) {
+                if ((size_t)x < M && (size_t)y < N) {
+                    const size_t len = commonPrefixBytes(
+                        (const unsigned char*)std::to_address(A.begin()) + x,
+                        (const unsigned char*)std::to_address(B.begin()) + y,
+                        std::min(M - (size_t)x, N - (size_t)y));
+                    x += (long long)len; y += (long long)len;
+                }
+            }
+            else {
+                while ((size_t)x < M && (size_t)y < N && (swapped ? cmp.impl(B[(size_t)y], A[(size_t)x]) : cmp.impl(A[(size_t)x], B[(size_t)y]))) {
+                    ++x; ++y;
+                }
             }
 
             path[(size_t)k + offset] = static_cast<long long>(pathCordinates.size());
@@ -146,6 +146,44 @@ namespace dtl {
             return e1 == e2;
         }
     };
+
+    /**
+     * length of the common prefix of two byte arrays, compares 16 bytes per step
+     */
+    inline size_t commonPrefixBytes (const unsigned char* a, const unsigned char* b, size_t n) {
+        size_t i = 0;
+#ifdef DTL_USE_SSE2
+        for (; i + 16 <= n; i += 16) {
+            const unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i*)(a + i)),
+                _mm_loadu_si128((const __m128i*)(b + i))));
+            if (mask != 0xFFFF) {
+                return i + (size_t)std::countr_one(mask);
+            }
+        }
+#endif
+        while (i < n && a[i] == b[i]) ++i;
+        return i;
+    }
+
+    /**
+     * length of the common suffix of two byte arrays, aEnd and bEnd point past the last byte
+     */
+    inline size_t commonSuffixBytes (const unsigned char* aEnd, const unsigned char* bEnd, size_t n) {
+        size_t i = 0;
+#ifdef DTL_USE_SSE2
+        for (; i + 16 <= n; i += 16) {
+            const unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i*)(aEnd - i - 16)),
+                _mm_loadu_si128((const __m128i*)(bEnd - i - 16))));
+            if (mask != 0xFFFF) {
+                return i + (size_t)std::countl_one((uint16_t)mask);
+            }
+        }
+#endif
+        while (i < n && aEnd[-1 - (ptrdiff_t)i] == bEnd[-1 - (ptrdiff_t)i]) ++i;
+        return i;
+    }
 }
 
 #endif // DTL_FUNCTORS_H
@@ -43,6 +43,15 @@
 #include <string>
 #include <algorithm>
 #include <iostream>
+#include <bit>
+#include <iterator>
+#include <type_traits>
+#include <cstdint>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define DTL_USE_SSE2
+#endif
 
 namespace dtl {
     
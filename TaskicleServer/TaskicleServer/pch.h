@@ -29,6 +29,7 @@
 #include "dtl\dtl.hpp"
 
 #include <txfw32.h>
+#include <chrono>
 
 using eck::PCVOID;
 // using eck::PCBYTE;// HP已有